@@ -0,0 +1,130 @@
+/* N-queens and SEND+MORE=MONEY searched at the same time, one search per
+   thread, then searches nested in another one through contexts.
+   CBack must be compiled with CBACK_TLS:
+   cc -DCBACK_TLS=_Thread_local -I../../SRC Parallel.c ../../SRC/CBack.c -lpthread */
+#include "CBack.h"
+#include <pthread.h>
+
+typedef struct Job {
+    int N;          /* queens, 0 for SEND+MORE=MONEY */
+    long Count;
+    char Text[32];
+} Job;
+
+static CBACK_TLS Job *J;
+static CBACK_TLS jmp_buf *Done;
+
+static void Return(void) 
+{ longjmp(*Done, 1); }
+
+/* runs S until its choices are exhausted, then returns (instead of
+   exiting as Backtrack() does) */
+#define Exhaust(S) {\
+    jmp_buf Env, *Saved = Done;\
+    Done = &Env;\
+    if (!setjmp(Env)) {\
+        Fiasco = Return;\
+        Backtracking(S)\
+    }\
+    Done = Saved;\
+}
+
+void Queens(void)
+{
+    int R[32] = {0}, S[64] = {0}, D[64] = {0}, N = J->N, r, c;
+
+    for (r = 1; r <= N; r++) {
+        c = Choice(N);
+        if (R[c] || S[r+c-2] || D[r-c+N-1])  
+            Backtrack();
+        R[c] = S[r+c-2] = D[r-c+N-1] = r;
+    }
+    J->Count++;
+    Backtrack();
+}
+
+#define Set(V) { V = Digits[i = Choice(k)-1]; Digits[i] = Digits[--k]; }    
+
+void SEND_MORE_MONEY(void)
+{
+    int Digits[10] = {0,1,2,3,4,5,6,7,8,9};
+    int S, E, N, D, M, O, R, Y;
+    int i, k = 10;
+
+    Set(S); if (S == 0) Backtrack(); Set(E); Set(N); Set(D); 
+    Set(M); if (M == 0) Backtrack(); Set(O); Set(R); Set(Y);
+
+    if (            S*1000L + E*100 + N*10 + D 
+                  + M*1000L + O*100 + R*10 + E !=
+         M*10000L + O*1000 + N*100 + E*10 + Y)
+        Backtrack();
+    sprintf(J->Text, "%d%d%d%d + %d%d%d%d = %d%d%d%d%d",
+            S,E,N,D,M,O,R,E,M,O,N,E,Y);
+    J->Count++;
+    Backtrack();
+}
+
+void Run(void)
+{
+    if (J->N) 
+        Queens(); 
+    else 
+        SEND_MORE_MONEY();
+}
+
+void *Thread(void *Arg)
+{
+    J = (Job*) Arg;
+    Exhaust(Run());
+    return 0;
+}
+
+/* an outer search choosing a board size, counting the solutions for
+   it with an inner search in a context of its own */
+void Outer(void)
+{
+    Job Sub = {0};
+    CBackContext *C, *Old;
+
+    Sub.N = 3 + Choice(5);
+    C = CreateContext();
+    Old = SwitchContext(C);
+    J = &Sub;
+    Exhaust(Queens());
+    SwitchContext(Old);
+    DestroyContext(C);
+    printf("nested: the %d-queens problem has %ld solutions.\n",
+           Sub.N, Sub.Count);
+    Backtrack();
+}
+
+int main(void)
+{
+    static const long Expected[] = {0,1,0,0,2,10,4,40,92,352,724};
+    Job Jobs[8];
+    pthread_t T[8];
+    int i, Failed = 0;
+
+    for (i = 0; i < 8; i++) {
+        Jobs[i].N = i ? i+3 : 0;
+        Jobs[i].Count = 0;
+        if (pthread_create(&T[i], 0, Thread, &Jobs[i])) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        pthread_join(T[i], 0);
+        if (Jobs[i].N) {
+            printf("The %d-queens problem has %ld solutions.\n",
+                   Jobs[i].N, Jobs[i].Count);
+            Failed |= Jobs[i].Count != Expected[Jobs[i].N];
+        } else {
+            printf("%s (%ld solution)\n", Jobs[i].Text, Jobs[i].Count);
+            Failed |= Jobs[i].Count != 1 || strcmp(Jobs[i].Text,
+                                           "9567 + 1085 = 10652");
+        }
+    }
+    Exhaust(Outer());
+    return Failed;
+}
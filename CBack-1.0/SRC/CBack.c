@@ -1,16 +1,24 @@
 #include "CBack.h"
-char *StackBottom = (char*) 0xeffff347;		
-int Merit;
-void (*Fiasco)(void);
+CBACK_TLS char *StackBottom = (char*) 0xeffff347;		
+CBACK_TLS int Merit;
+CBACK_TLS void (*Fiasco)(void);
 
 #define StackSize labs(StackBottom - StackTop)
 #define Synchronize /* {jmp_buf E; if (!setjmp(E)) longjmp(E,1);} */
+/* what Backtrack() does when no choice is left, after Fiasco */
+#ifndef Exhausted
+#define Exhausted() exit(0)
+#endif
 
 typedef struct State {   
     struct State *Previous;	 	
-    unsigned int LastChoice, Alternatives;
+    unsigned int LastChoice, Alternatives, Class;
     int Merit;
     char *StackBottom, *StackTop;
+#ifdef CBACK_DELTA
+    struct State *Base;
+    char *End;
+#endif
     jmp_buf Environment;   
 } State;
 
@@ -20,11 +28,32 @@ typedef struct Notification {
     struct Notification *Next;
 } Notification;
 
-static State *TopState = 0, *Previous, *S;
-static unsigned int LastChoice = 0, Alternatives = 0;
-static char *StackTop;
-static Notification *FirstNotification = 0;
-static size_t NotifiedSpace = 0;
+static CBACK_TLS State *TopState = 0, *Previous, *S;
+static CBACK_TLS unsigned int LastChoice = 0, Alternatives = 0;
+static CBACK_TLS char *StackTop;
+static CBACK_TLS Notification *FirstNotification = 0;
+static CBACK_TLS size_t NotifiedSpace = 0;
+
+/* States popped, for reuse by the next pushes: class K holds blocks of
+   PoolBlock << K bytes. Choice points are mostly popped in the reverse
+   order of the pushes, so a few blocks per class serve a whole search. */
+#define PoolBlock 256
+#define PoolClasses 32
+static CBACK_TLS State *Pool[PoolClasses];
+CBACK_TLS size_t AllocatedBytes = 0, RecycledBytes = 0;
+
+/* the variables above and the public ones, for a search not running */
+struct CBackContext {
+    State *TopState;
+    unsigned int LastChoice, Alternatives;
+    Notification *FirstNotification;
+    size_t NotifiedSpace;
+    char *StackBottom;
+    int Merit;
+    void (*Fiasco)(void);
+};
+
+static CBACK_TLS CBackContext Initial, *Current = 0;
 
 static void Error(char *Msg)
 {
@@ -35,20 +64,76 @@ static void Error(char *Msg)
 static void PopState(void) 
 {
     Previous = TopState->Previous;
-    free(TopState); 
+    TopState->Previous = Pool[TopState->Class];
+    Pool[TopState->Class] = TopState;
     TopState = Previous;
 }
 
+#ifdef CBACK_DELTA
+/* Delta snapshots (-DCBACK_DELTA): a State saves the stack from StackTop
+   to End only, the rest up to StackBottom being as in the snapshot of
+   its Base, the State on top when it was pushed (0: all saved). For
+   stacks growing downwards; Base outlives the State since it lies below
+   it, unless Merit inserts the State further down: then all is saved. */
+#define Snapshot(S) ((char*) (S) + sizeof(State) + NotifiedSpace)
+#define DeltaChunk 256
+
+/* the end of the part of the stack differing from the snapshot of S */
+static char *Changed(State *S)
+{
+    char *Lo = StackTop > S->StackTop ? StackTop : S->StackTop, *End = Lo, *P;
+    size_t Chunk;
+
+    for (; Lo < StackBottom; S = S->Base) {
+        for (P = S->End; P > Lo; P -= Chunk) {
+            Chunk = P - Lo < DeltaChunk ? P - Lo : DeltaChunk;
+            if (memcmp(P - Chunk, Snapshot(S) + (P - Chunk - S->StackTop), Chunk)) {
+                End = P;
+                break;
+            }
+        }
+        if (S->End > Lo) 
+            Lo = S->End;
+    }
+    return End;
+}
+#endif
+
 static void PushState(void) 
 {
-    static char *B;
+    static CBACK_TLS char *B;
     Notification *N;
+    size_t Size, Block;
+    unsigned int K;
+#ifdef CBACK_DELTA
+    State *Base = 0;
+    char *End = StackBottom;
+#endif
 
     StackTop = (char*) &N;
     Previous = TopState;
-    TopState = (State*) malloc(sizeof(State) + NotifiedSpace + StackSize);
-    if (!TopState) 
+#ifdef CBACK_DELTA
+    if (Previous && Previous->StackBottom == StackBottom && 
+        Previous->Merit <= Merit && StackTop < StackBottom) 
+        End = Changed(Base = Previous);
+    Size = sizeof(State) + NotifiedSpace + (End > StackTop ? End - StackTop : StackSize);
+#else
+    Size = sizeof(State) + NotifiedSpace + StackSize;
+#endif
+    for (K = 0, Block = PoolBlock; Block < Size; K++) 
+        Block <<= 1;
+    if (K >= PoolClasses) 
         Error("No more space available for Choice");
+    if ((TopState = Pool[K])) {
+        Pool[K] = TopState->Previous;
+        RecycledBytes += Block;
+    } else {
+        TopState = (State*) malloc(Block);
+        if (!TopState) 
+            Error("No more space available for Choice");
+        AllocatedBytes += Block;
+    }
+    TopState->Class = K;
     TopState->Previous = Previous;
     TopState->LastChoice = LastChoice;
     TopState->Alternatives = Alternatives;
@@ -59,6 +144,14 @@ static void PushState(void)
     for (N = FirstNotification; N; B += N->Size, N = N->Next) 
         memcpy(B, N->Base, N->Size);
     Synchronize;
+#ifdef CBACK_DELTA
+    TopState->Base = Base;
+    TopState->End = End;
+    if (StackTop < StackBottom) {
+        memcpy(B, StackTop, End - StackTop);
+        return;
+    }
+#endif
     memcpy(B,StackBottom < StackTop ? StackBottom : StackTop, StackSize);
 }
 
@@ -96,7 +189,7 @@ void Backtrack(void)
     if (!TopState) { 
         if (Fiasco) 
             Fiasco(); 
-        exit(0);
+        Exhausted();
     }   
     StackTop = (char*) &N;   
     if ((StackBottom < StackTop) == (StackTop < TopState->StackTop)) 
@@ -110,6 +203,16 @@ void Backtrack(void)
     for (N = FirstNotification; N; B += N->Size, N = N->Next)   
         memcpy(N->Base, B, N->Size);  
     Synchronize;
+#ifdef CBACK_DELTA
+    if (StackTop < StackBottom) {
+        for (S = TopState, B = StackTop; B < StackBottom; S = S->Base) 
+            if (S->End > B) {
+                memcpy(B, Snapshot(S) + (B - S->StackTop), S->End - B);
+                B = S->End;
+            }
+        longjmp(TopState->Environment, 1);
+    }
+#endif
     memcpy(StackBottom < StackTop ? StackBottom : StackTop,B, StackSize);
     longjmp(TopState->Environment, 1);
 } 
@@ -183,3 +286,62 @@ void ClearNotifications(void)
    while (FirstNotification)
        RemoveNotification(FirstNotification->Base);            
 }
+
+void ClearPool(void) 
+{
+    unsigned int K;
+
+    for (K = 0; K < PoolClasses; K++) {
+        while ((S = Pool[K])) {
+            Pool[K] = S->Previous;
+            free(S);
+        }
+    }
+}
+
+CBackContext *CreateContext(void)
+{
+    CBackContext *C = (CBackContext*) calloc(1, sizeof(CBackContext));
+    if (!C) 
+        Error("No more space for context");
+    C->StackBottom = (char*) 0xeffff347;
+    return C;
+}
+
+CBackContext *SwitchContext(CBackContext *C)
+{
+    CBackContext *Old = Current ? Current : &Initial;
+    if (C == Old) 
+        return Old;
+    Old->TopState = TopState;
+    Old->LastChoice = LastChoice;
+    Old->Alternatives = Alternatives;
+    Old->FirstNotification = FirstNotification;
+    Old->NotifiedSpace = NotifiedSpace;
+    Old->StackBottom = StackBottom;
+    Old->Merit = Merit;
+    Old->Fiasco = Fiasco;
+    if (!C) 
+        C = &Initial;
+    TopState = C->TopState;
+    LastChoice = C->LastChoice;
+    Alternatives = C->Alternatives;
+    FirstNotification = C->FirstNotification;
+    NotifiedSpace = C->NotifiedSpace;
+    StackBottom = C->StackBottom;
+    Merit = C->Merit;
+    Fiasco = C->Fiasco;
+    Current = C;
+    return Old;
+}
+
+void DestroyContext(CBackContext *C)
+{
+    CBackContext *Old;
+    if (!C || C == &Initial) 
+        return;
+    Old = SwitchContext(C);
+    ClearAll();
+    SwitchContext(Old == C ? 0 : Old);
+    free(C);
+}
@@ -0,0 +1,69 @@
+/* CBack on fibers: the search runs on a stack of its own (POSIX ucontext),
+   whose top is StackBottom; the choice points are those of CBack.c. */
+#ifndef CBACK_FIBER
+#define CBACK_FIBER
+#endif
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static void Leave(void);
+#define Exhausted() Leave()
+#include "CBack.c"
+
+#ifndef CBACK_FIBER_STACK
+#define CBACK_FIBER_STACK (256 << 10)
+#endif
+
+/* where Fiber() was called, the function it runs, and a stack kept for
+   the next call */
+static CBACK_TLS ucontext_t *Caller;
+static CBACK_TLS void (*Body)(void);
+static CBACK_TLS char *Spare;
+
+static void Leave(void)
+{
+    if (!Caller) 
+        exit(0);
+    setcontext(Caller);
+}
+
+static void Start(void)
+{
+    Body();
+}
+
+void Fiber(void (*F)(void))
+{
+    ucontext_t Run, Return, *SavedCaller = Caller;
+    void (*SavedBody)(void) = Body;
+    char *SavedBottom = StackBottom, *Stack = Spare;
+    size_t Page = sysconf(_SC_PAGESIZE);
+
+    if (Stack) 
+        Spare = 0;
+    else {
+        Stack = (char*) mmap(0, Page + CBACK_FIBER_STACK, PROT_READ | PROT_WRITE, 
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (Stack == MAP_FAILED) 
+            Error("No more space for Fiber");
+        mprotect(Stack, Page, PROT_NONE); /* overflows fault */
+    }
+    if (getcontext(&Run)) 
+        Error("Fiber (getcontext)");
+    Run.uc_stack.ss_sp = Stack + Page;
+    Run.uc_stack.ss_size = CBACK_FIBER_STACK;
+    Run.uc_link = &Return;
+    makecontext(&Run, Start, 0);
+    Caller = &Return;
+    Body = F;
+    StackBottom = Stack + Page + CBACK_FIBER_STACK;
+    swapcontext(&Return, &Run);
+    StackBottom = SavedBottom;
+    Body = SavedBody;
+    Caller = SavedCaller;
+    if (Spare) 
+        munmap(Stack, Page + CBACK_FIBER_STACK);
+    else 
+        Spare = Stack;
+}
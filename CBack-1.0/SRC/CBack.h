@@ -1,11 +1,26 @@
 #ifndef Backtracking
+#ifdef CBACK_FIBER
+/* CBack.fiber.c: S runs on a stack of its own, in a GCC nested function;
+   S must not use the locals around (or GCC makes the stack executable) */
+#define Backtracking(S) { void CBackBody(void) { S; } Fiber(CBackBody); }
+#else
 #define Backtracking(S) {char Dummy; StackBottom = &Dummy; S; } 
+#endif
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <setjmp.h>
 
+/* Compiled with CBACK_TLS defined as a thread-local storage class
+   (e.g. -DCBACK_TLS=_Thread_local), every thread backtracks on its own. */
+#ifdef CBACK_TLS
+#define CBACK_THREADS 1
+#else
+#define CBACK_TLS
+#define CBACK_THREADS 0
+#endif
+
 #define Notify(V) NotifyStorage(&V, sizeof(V))
 #define Nmalloc(Size) NotifyStorage(malloc(Size), Size)
 #define Ncalloc(N, Size) NotifyStorage(calloc(N,Size), (N)*Size)
@@ -25,7 +40,33 @@ void *NotifyStorage(void *Base, size_t Size);
 void RemoveNotification(void *Base);
 void ClearNotifications(void);
 
-extern char *StackBottom;
-extern void (*Fiasco)(void);
-extern int Merit;  
+/* CBack.c keeps the choice points popped for reuse (per thread with
+   CBACK_TLS); ClearPool() gives their memory back. AllocatedBytes and
+   RecycledBytes count the bytes of choice points taken from malloc()
+   and from the pool. */
+void ClearPool(void);
+extern CBACK_TLS size_t AllocatedBytes, RecycledBytes;
+
+/* Contexts (CBack.c only): the whole state of a search, so that one
+   can be suspended while another runs on the same thread, e.g. a search
+   nested in a step of another. SwitchContext() makes C (0: the one the
+   thread started with) the current context and returns the previous
+   one. With CBACK_TLS every thread has its own current context. */
+typedef struct CBackContext CBackContext;
+CBackContext *CreateContext(void);
+CBackContext *SwitchContext(CBackContext *C);
+void DestroyContext(CBackContext *C);
+
+#ifdef CBACK_FIBER
+/* CBack.fiber.c: runs F on a fiber, a stack of CBACK_FIBER_STACK bytes
+   reserved for the search, so that choice points save its frames only.
+   Returns when F does, or when its choices are exhausted (after Fiasco).
+   The search is that of the current context: use one of its own to
+   nest it in another. */
+void Fiber(void (*F)(void));
+#endif
+
+extern CBACK_TLS char *StackBottom;
+extern CBACK_TLS void (*Fiasco)(void);
+extern CBACK_TLS int Merit;  
 #endif
@@ -1,7 +1,7 @@
 #include "CBack.h"
-char *StackBottom = (char*) 0xeffff347;
-int Merit;
-void (*Fiasco)(void);
+CBACK_TLS char *StackBottom = (char*) 0xeffff347;
+CBACK_TLS int Merit;
+CBACK_TLS void (*Fiasco)(void);
 #define StackSize labs(StackBottom - StackTop)
 #define Syncronize /* {jmp_buf E; if (!setjmp(E)) longjmp(E,1);} */
 
@@ -20,11 +20,11 @@ typedef struct Notification {
     struct Notification *Next;
 } Notification;
 
-static State *TopState = 0, *FirstFree = 0, *NewState, *S;
-static unsigned int LastChoice = 0, Alternatives = 0;
-static char *StackTop;
-static Notification *FirstNotification = 0;
-static size_t NotifiedSpace = 0;
+static CBACK_TLS State *TopState = 0, *FirstFree = 0, *NewState, *S;
+static CBACK_TLS unsigned int LastChoice = 0, Alternatives = 0;
+static CBACK_TLS char *StackTop;
+static CBACK_TLS Notification *FirstNotification = 0;
+static CBACK_TLS size_t NotifiedSpace = 0;
 
 static State *Merge(State *H1, State *H2) {
     State *LeftChild;
@@ -68,8 +68,8 @@ static void Error(char *Msg)
 
 static void PushState(void) 
 {
-    static char *B;
-    static size_t Size;
+    static CBACK_TLS char *B;
+    static CBACK_TLS size_t Size;
     Notification *N;
     
     StackTop = (char*) &N;
@@ -77,7 +77,7 @@ static void PushState(void)
     NewState = 0;
     if (FirstFree) {
         for (S = 0, NewState = FirstFree; NewState; S = NewState, NewState = S->Next) 
-            if (NewState->Size <= Size)
+            if (NewState->Size >= Size)
                 break;
         if (NewState) {
             if (!S) 
@@ -88,9 +88,9 @@ static void PushState(void)
     }
     if (!NewState) {
         NewState = (State*) malloc(Size);
-        NewState->Size = Size;
         if (!NewState) 
             Error("No more space available for Choice");
+        NewState->Size = Size;
     }
     NewState->LastChoice = LastChoice;
     NewState->Alternatives = Alternatives;
@@ -24,33 +24,49 @@ exit $?
 #include <unistd.h>
 #include <locale.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#endif
 
 #ifdef _OPENMP
 #include <omp.h>
+#define PRAGMA_OMP(...)     _Pragma(PRAGMA_STR(omp __VA_ARGS__))
+#else
+#define PRAGMA_OMP(...)     /* no warning without OpenMP */
 #endif
+#define PRAGMA_STR(...)     #__VA_ARGS__
 
 #include "CBack-1.0/SRC/CBack.h"
 
 #ifdef EASY
+#define VARIANT             "EASY"
 #define SIZE                5
 #define MAX_OP              1
 #define URL                 "https://easy.mathler.com/"
 
 #elif defined(NORMAL)
+#define VARIANT             "NORMAL"
 #define SIZE                6
 #define MAX_OP              2
 #define URL                 "https://mathler.com/"
 
 #elif defined(HARD)
+#define VARIANT             "HARD"
 #define SIZE                8
 #define MAX_OP              3
 #define URL                 "https://hard.mathler.com/"
 
 #elif defined(THENUMBLE)
+#define VARIANT             "THENUMBLE"
 #define SIZE                7
 #define URL                 "https://www.thenumble.app/"
 
 #elif defined(NUMBLE)
+#define VARIANT             "NUMBLE"
 #define SIZE                8
 #define URL                 "https://www.mathix.org/numble/"
 
@@ -58,6 +74,7 @@ exit $?
 #error Please define one of EASY, NORMAL, HARD, NUMBLE, THENUMBLE.
 #define SIZE                1
 #define URL                 ""
+#define VARIANT             ""
 #endif
 
 #ifndef MAX_OP
@@ -72,7 +89,84 @@ exit $?
 #define DO_SORT             1
 #define FASTER_RAND         1
 
+#define SCORE_COLORS        0   /* count formulae for each color code */
+#define SCORE_HISTOGRAM     1   /* histogram of the feedbacks */
+#define SCORE_DFS           2   /* color codes walked one trit at a time */
+
+#ifndef SCORING
+#define SCORING             SCORE_HISTOGRAM
+#endif
+
+#if SCORING==SCORE_HISTOGRAM
+#define MAX_FORMULAE_EXACT  (60000)
+#else
 #define MAX_FORMULAE_EXACT  (15000)
+#endif
+
+#ifndef FEEDBACK_MATRIX
+#define FEEDBACK_MATRIX     (SCORING==SCORE_HISTOGRAM)
+#endif
+#ifndef MATRIX_EAGER                    /* whole universe, before round 1 */
+#define MATRIX_EAGER        0
+#endif
+#define MATRIX_MAX_RAM      (512ll<<20) /* bigger matrices go on disk  */
+#define MATRIX_MAX_DISK     (8ll<<30)   /* bigger ones are not built   */
+#define MATRIX_TILE         (256)       /* formulae per tile dimension */
+
+#ifndef BITSET_INDEX
+#define BITSET_INDEX        (SCORING==SCORE_COLORS)
+#endif
+#define BITSET_BLOCK        (64)        /* words between two early outs */
+
+#define BATCH_STATES        (16)        /* color codes scored together */
+#define BATCH_TILE          (1024)      /* formulae kept hot between them */
+
+#ifndef STATE_CACHE
+#define STATE_CACHE         (SCORING!=SCORE_HISTOGRAM)
+#endif
+#define STATE_CACHE_BITS    (20)        /* log2 of the number of entries */
+#define STATE_CACHE_LOCKS   (64)        /* stripes of entries per lock */
+
+#define ARENA_HUGEPAGES     1
+
+#ifndef STREAM_FINDALL                  /* guesses while enumerating */
+#if defined(_OPENMP) && !defined(_WIN32)
+#define STREAM_FINDALL      1
+#else
+#define STREAM_FINDALL      0
+#endif
+#endif
+#define STREAM_CHUNK        (4096)      /* equations handed over at once */
+#define STREAM_FIRST        (1<<14)     /* equations before a first guess */
+#define STREAM_CANDIDATES   (64)        /* guesses scored each time */
+#define STREAM_SECRETS      (2048)      /* against that many equations */
+
+#define ENUM_CBACK          0   /* backtracking over the grammar */
+#define ENUM_DP             1   /* values of the sub-spans built bottom-up */
+#define ENUM_SKELETON       2   /* digit fillings of the operator skeletons */
+
+#ifdef CBACK_BEST_FIRST                 /* CBack follows Merit (Makefile) */
+#define BEST_FIRST          1
+#else
+#define BEST_FIRST          0
+#endif
+
+#ifndef ENUMERATOR
+#if BEST_FIRST || defined(CBACK_FIBER)  /* a CBack backend was chosen */
+#define ENUMERATOR          ENUM_CBACK
+#else
+#define ENUMERATOR          ENUM_DP
+#endif
+#endif
+
+#ifndef FORMULA_DB                      /* sorted formulae cached on disk */
+#ifdef _WIN32
+#define FORMULA_DB          0
+#else
+#define FORMULA_DB          DO_SORT
+#endif
+#endif
+#define FORMULA_DB_VERSION  3
 
 /*****************************************************************************/
 
@@ -82,6 +176,13 @@ exit $?
 #define ALLOW_PARENTHESIS   0
 #endif
 #define PRIVATE             static
+#ifdef __GNUC__
+#define INLINE              static inline __attribute__((always_inline))
+#define NOINLINE            static __attribute__((noinline))
+#else
+#define INLINE              static inline
+#define NOINLINE            static
+#endif
 
 typedef int integer;
 
@@ -118,6 +219,24 @@ PRIVATE int popcount(uint32_t _x) {
 #endif
 }
 
+#if BITSET_INDEX
+PRIVATE int popcount64(uint64_t x) {
+#ifdef __GNUC__
+    return __builtin_popcountll(x);
+#else
+    return popcount(x) + popcount(x>>32);
+#endif
+}
+#endif
+
+PRIVATE int ctz(uint32_t x) {
+#ifdef __GNUC__
+    return __builtin_ctz(x);
+#else
+    return popcount((x & -x) - 1);
+#endif
+}
+
 /*****************************************************************************/
 
 PRIVATE void gettime(struct timeval *tv) {
@@ -289,6 +408,15 @@ PRIVATE void *_ARRAY_PTR(void *_array, size_t n) {
 #define ARRAY_ADD(ARRAY,VAL)                                \
     ARRAY_AT((ARRAY),(ARRAY).len++)=(VAL)
 
+/* keeps, in order, the cells at INDEX for which COND holds */
+#define ARRAY_FILTER(ARRAY, INDEX, COND) do {               \
+    size_t INDEX, _j;                                       \
+    for(INDEX = _j = 0; INDEX<(ARRAY).len; ++INDEX) {       \
+        if(COND) (ARRAY).tab[_j++] = (ARRAY).tab[INDEX];    \
+    }                                                       \
+    (ARRAY).len = _j;                                       \
+} while(0)
+
 #if 0
 #define ARRAY_ADD(ARRAY, VAL) do {                          \
     _ARRAY_ENSURE_CAPA(&(ARRAY), ++(ARRAY).len);            \
@@ -372,6 +500,7 @@ PRIVATE integer gcd(integer a, integer b) {
 
 PRIVATE void rat_norm(rat *r, integer p, integer q) {
     integer t = gcd(p,q);
+    if(q < 0) t = -t; /* keeps the sign on p, see number() */
     r->p = p/t;
     r->q = q/t;
 }
@@ -432,6 +561,8 @@ typedef enum {
     MSKnone=0
 } mask;
 
+#define SYMBOLS 16 /* bits in a mask */
+
 PRIVATE const mask MSKall = MSKnone
     | MSK0
     | MSK1
@@ -532,9 +663,146 @@ PRIVATE opt_rat *factor(opt_rat *T, int from, int to);
 PRIVATE opt_rat *number(opt_rat *T, int from, int to);
 
 PRIVATE char buffer[SIZE];
+PRAGMA_OMP(threadprivate(buffer))
+
+/* what the equations must satisfy while they are generated: the symbols
+   forbidden at each position and those required somewhere (see
+   constrain()), checked as soon as the symbols are written */
+PRIVATE struct constraint {
+    bool on;
+    mask forbidden[SIZE];
+    mask required;
+} constraint;
+
+/* operators written so far by the backtracking, notified to CBack */
+PRIVATE int ops;
+PRAGMA_OMP(threadprivate(ops))
+
+#if BEST_FIRST
+/* symbols written so far by the backtracking and their number, notified
+   to CBack: the Merit of a partial equation is minus its repeated
+   symbols, so that those using SIZE distinct ones come out first */
+PRIVATE mask written;
+PRIVATE int  writes;
+PRAGMA_OMP(threadprivate(written, writes))
+#endif
+
+/* writes symbol c at position pos of buffer, unless it is forbidden */
+PRIVATE bool put(int pos, char c) {
+    if(constraint.on && (constraint.forbidden[pos] & char_to_mask(c)))
+        return false;
+    buffer[pos] = c;
+#if BEST_FIRST
+    written |= char_to_mask(c);
+    Merit = popcount(written) - ++writes;
+#endif
+    return true;
+}
 
 typedef opt_rat *(*goal)(opt_rat *T, int from, int to);
 
+/* range of the values of a nonterminal over a width with at most some
+   operators, and bound of their denominators (so that no non-zero value
+   is closer to 0 than 1/den). Empty when lo > hi. */
+typedef struct bound {
+    double lo, hi, den;
+} bound;
+
+enum { B_E, B_T, B_F, B_N, B_NT };  /* expression, term, factor, number */
+
+PRIVATE bound bounds[B_NT][SIZE+1][MAX_OP+1];
+
+PRIVATE void bound_union(bound *b, double lo, double hi, double den) {
+    if(lo < b->lo) b->lo = lo;
+    if(hi > b->hi) b->hi = hi;
+    if(den > b->den) b->den = den;
+}
+
+PRIVATE void bound_mul(bound *r, const bound *a, const bound *b) {
+    const double p[4] = {a->lo*b->lo, a->lo*b->hi, a->hi*b->lo, a->hi*b->hi};
+    int i;
+    for(i=0; i<4; ++i) bound_union(r, p[i], p[i], a->den*b->den);
+}
+
+/* a/b for the values of b of constant sign, at least 1/den away from 0 */
+PRIVATE void bound_div(bound *r, const bound *a, const bound *b) {
+    const double m = b->hi > -b->lo ? b->hi : -b->lo, eps = 1/b->den;
+    double piece[2][2];
+    int n = 0, i, j;
+
+    if(b->hi >= eps) {
+        piece[n][0] = b->lo > eps ? b->lo : eps;
+        piece[n++][1] = b->hi;
+    }
+    if(b->lo <= -eps) {
+        piece[n][0] = b->lo;
+        piece[n++][1] = b->hi < -eps ? b->hi : -eps;
+    }
+    for(i=0; i<n; ++i) for(j=0; j<2; ++j) {
+        bound_union(r, a->lo/piece[i][j], a->lo/piece[i][j], a->den*m*b->den);
+        bound_union(r, a->hi/piece[i][j], a->hi/piece[i][j], a->den*m*b->den);
+    }
+}
+
+PRIVATE void bound_add(bound *r, const bound *a, const bound *b, int sign) {
+    const double x = a->lo + sign*(sign>0 ? b->lo : b->hi);
+    const double y = a->hi + sign*(sign>0 ? b->hi : b->lo);
+    bound_union(r, x, y, a->den*b->den);
+}
+
+/* the bounds, by interval arithmetic over the grammar */
+PRIVATE void bounds_init(void) {
+    static bool done = false;
+    int nt, w, k, s, ka, kb;
+
+    if(done) return;
+    done = true;
+    for(nt=0; nt<B_NT; ++nt) for(w=0; w<=SIZE; ++w) for(k=0; k<=MAX_OP; ++k) {
+        bounds[nt][w][k].lo  = HUGE_VAL;
+        bounds[nt][w][k].hi  = -HUGE_VAL;
+        bounds[nt][w][k].den = 1;
+    }
+    for(w=1; w<=SIZE; ++w) for(k=0; k<=MAX_OP; ++k) {
+        bound *N = &bounds[B_N][w][k], *F = &bounds[B_F][w][k];
+        bound *T = &bounds[B_T][w][k], *E = &bounds[B_E][w][k];
+        N->lo = w==1 ? 0 : pow(10, w-1);
+        N->hi = pow(10, w) - 1;
+
+        // factor ::= number | ( expression )
+        *F = *N;
+#if ALLOW_PARENTHESIS
+        if(w >= 3 && bounds[B_E][w-2][k].lo <= bounds[B_E][w-2][k].hi)
+            bound_union(F, bounds[B_E][w-2][k].lo, bounds[B_E][w-2][k].hi,
+                           bounds[B_E][w-2][k].den);
+#endif
+
+        // term ::= factor | term * factor | term / factor
+        *T = *F;
+        for(s=1; s<w-1; ++s) for(ka=0; ka<k; ++ka) for(kb=0; ka+kb<k; ++kb) {
+            const bound *a = &bounds[B_T][s][ka], *b = &bounds[B_F][w-s-1][kb];
+            if(a->lo > a->hi || b->lo > b->hi) continue;
+            bound_mul(T, a, b);
+            bound_div(T, a, b);
+        }
+
+        // expression ::= term | expression + term | expression - term
+        *E = *T;
+        for(s=1; s<w-1; ++s) for(ka=0; ka<k; ++ka) for(kb=0; ka+kb<k; ++kb) {
+            const bound *a = &bounds[B_E][s][ka], *b = &bounds[B_T][w-s-1][kb];
+            if(a->lo > a->hi || b->lo > b->hi) continue;
+            bound_add(E, a, b, +1);
+            bound_add(E, a, b, -1);
+        }
+    }
+}
+
+/* can nonterminal nt be worth v over the width with the operators left? */
+PRIVATE bool in_bounds(int nt, int width, const rat *v) {
+    const bound *b = &bounds[nt][width][ops < MAX_OP ? MAX_OP - ops : 0];
+    const double x = (double)v->p / v->q, eps = 1e-9*(1 + fabs(x));
+    return b->lo - eps <= x && x <= b->hi + eps && v->q <= b->den;
+}
+
 /*
  * solves T = U op V
  *
@@ -545,7 +813,8 @@ typedef opt_rat *(*goal)(opt_rat *T, int from, int to);
 PRIVATE opt_rat *solve(opt_rat *T, goal goal, opt_rat *U, int from, int to, char op, opt_rat *V) {
     assert(V->set);
 
-    buffer[to] = op;
+    if(op != '=' && ++ops > MAX_OP) Backtrack();
+    if(!put(to, op)) Backtrack();
     switch(op) {
         case '+':
         if(T->set) {
@@ -603,6 +872,7 @@ PRIVATE opt_rat *solve(opt_rat *T, goal goal, opt_rat *U, int from, int to, char
 PRIVATE opt_rat *expression(opt_rat *T, int from, int to) {
     char op;
 
+    if(T->set && !in_bounds(B_E, to - from, &T->val)) Backtrack();
     switch(Choice(3)) {
         case 1: // expression ::= term
         return term(T, from, to);
@@ -624,6 +894,9 @@ PRIVATE opt_rat *expression(opt_rat *T, int from, int to) {
 
 PRIVATE opt_rat *term(opt_rat *T, int from, int to) {
     char op;
+
+    if(T->set && !in_bounds(B_T, to - from, &T->val)) Backtrack();
+
     switch(Choice(3)) {
         case 1: // term ::= factor
         return factor(T, from, to);
@@ -644,6 +917,7 @@ PRIVATE opt_rat *term(opt_rat *T, int from, int to) {
 }
 
 PRIVATE opt_rat *factor(opt_rat *T, int from, int to) {
+    if(T->set && !in_bounds(B_F, to - from, &T->val)) Backtrack();
     switch(Choice(1
 #if ALLOW_PARENTHESIS
                     +1
@@ -653,9 +927,7 @@ PRIVATE opt_rat *factor(opt_rat *T, int from, int to) {
         return number(T, from, to);
 
         case 2: // factor ::= ( expression )
-        if(to-from<3) Backtrack();
-        buffer[from] = '(';
-        buffer[to-1] = ')';
+        if(to-from<3 || !put(from, '(') || !put(to-1, ')')) Backtrack();
         return expression(T, from+1, to-1);
     }
     assert(false);
@@ -665,7 +937,7 @@ PRIVATE opt_rat *factor(opt_rat *T, int from, int to) {
 PRIVATE bool num(int n, int from, int to) {
     int j = to;
     do {
-        buffer[--j] = '0' + (n%10);
+        if(!put(--j, '0' + (n%10))) return false;
         n /= 10;
     } while(n && from<j);
     return n==0 && from==j;
@@ -690,174 +962,1698 @@ PRIVATE opt_rat *number(opt_rat *T, int from, int to) {
         integer i = ipow(10, to - from - 1);
         rat_integer(&T->val, Choice(i==1 ? 10 : (9*i)) + i - (i==1 ? 2 : 1));
         T->set = true;
-        (void)num(T->val.p, from, to);
+        if(!num(T->val.p, from, to)) Backtrack();
     }
     return T;
 }
 
 /*****************************************************************************/
 
-#ifdef SIMD
-#ifdef __SSE4_1__
-#include <immintrin.h>
-#define SIMD_TYPE __m128i
-#else
-/* poor man SIMD: use 32/64 bits to handle 2 or for 4 masks in one go */
-#define SIMD_TYPE uint_fast32_t 
-#endif
-#endif
-
 typedef union {
-#ifdef  SIMD_TYPE
-    SIMD_TYPE   vect[(SIZE*sizeof(mask)+sizeof(SIMD_TYPE)-1)/sizeof(SIMD_TYPE)];
-#endif
     mask        masks[SIZE];
 } masks;
 
+/* all the formulae live in a single arena, one column per field, and
+   are designated by their 32-bit index in it. The symbols are packed
+   in 32 bits, one nibble per position holding the bit number of its
+   mask (SIZE never exceeds 8 and there are at most 16 symbols). */
+typedef uint32_t formula;
+
+PRIVATE struct arena {
+    size_t          capa, len;
+    uint32_t        *packed;          /* symbol at each position */
+    mask            *unused;          /* symbols not in the formula */
+    unsigned char   *used_count;      /* distinct symbols in the formula */
+    void            *mapped;          /* read-only file holding the columns */
+    size_t          mapped_size;
+} arena;
+
+#define NIBBLE(F, I)    ((arena.packed[(F)] >> (4*(I))) & 15)
+#define SYMBOL(F, I)    ((mask)(1u << NIBBLE((F), (I))))
+#define UNUSED(F)       arena.unused[(F)]
+#define USED_COUNT(F)   arena.used_count[(F)]
+
+PRIVATE void *arena_column(void *old, size_t len, size_t capa, size_t cell) {
+    const size_t size = capa*cell + 64; /* for over-reading kernels */
+    void *ptr;
+#if ARENA_HUGEPAGES && defined(MADV_HUGEPAGE)
+    const size_t HUGE = 2<<20;
+    if(size >= HUGE) {
+        ptr = aligned_alloc(HUGE, ((size+HUGE-1)/HUGE)*HUGE);
+        if(ptr!=NULL) madvise(ptr, ((size+HUGE-1)/HUGE)*HUGE, MADV_HUGEPAGE);
+    } else
+#endif
+    ptr = malloc(size);
+    assert(ptr!=NULL);
+    if(old!=NULL) {
+        memcpy(ptr, old, len*cell);
+        free(old);
+    }
+    return ptr;
+}
+
+PRIVATE void arena_grow(size_t capa) {
+    if(capa <= arena.capa) return;
+    assert(arena.mapped == NULL);
+    if(capa < 2*arena.capa) capa = 2*arena.capa;
+    if(capa < 1024) capa = 1024;
+    arena.packed     = arena_column(arena.packed,
+        arena.len, capa, sizeof(uint32_t));
+    arena.unused     = arena_column(arena.unused,
+        arena.len, capa, sizeof(mask));
+    arena.used_count = arena_column(arena.used_count,
+        arena.len, capa, sizeof(unsigned char));
+    arena.capa = capa;
+}
+
+/* symbols packed the way the arena stores them */
+PRIVATE uint32_t symbols_pack(const char *symbols) {
+    uint32_t packed = 0;
+    int i;
+    for(i=0; i<SIZE; ++i) packed |= ctz(char_to_mask(symbols[i])) << (4*i);
+    return packed;
+}
+
+PRIVATE formula arena_add_packed(uint32_t packed) {
+    formula f = arena.len;
+    mask unused = MSKall;
+    int i;
+
+    assert(arena.len < UINT32_MAX);
+    arena_grow(arena.len+1);
+    for(i=0; i<SIZE; ++i) unused &= ~(mask)(1u << ((packed >> (4*i)) & 15));
+    arena.packed[f] = packed;
+    UNUSED(f)     = unused;
+    USED_COUNT(f) = popcount(MSKall ^ unused);
+    ++arena.len;
+    return f;
+}
+
+PRIVATE formula arena_add(const char *symbols) {
+    return arena_add_packed(symbols_pack(symbols));
+}
+
+/* renumbers the arena so that the formulae listed in tab (which must be
+   the whole arena) appear in that order, and rewrites tab accordingly */
+PRIVATE void arena_reorder(formula *tab, size_t len) {
+    void *tmp = malloc(len*sizeof(uint32_t));
+    size_t j;
+
+    assert(len == arena.len);
+    if(tmp==NULL) return;
+#define PERMUTE(COLUMN, TYPE) do {                          \
+    TYPE *t = tmp;                                          \
+    for(j=0; j<len; ++j) t[j] = (COLUMN)[tab[j]];           \
+    memcpy((COLUMN), t, len*sizeof(TYPE));                  \
+} while(0)
+    PERMUTE(arena.packed,     uint32_t);
+    PERMUTE(arena.unused,     mask);
+    PERMUTE(arena.used_count, unsigned char);
+#undef PERMUTE
+    for(j=0; j<len; ++j) tab[j] = j;
+    free(tmp);
+}
+
+PRIVATE void arena_done(void) {
+#if FORMULA_DB
+    if(arena.mapped != NULL) munmap(arena.mapped, arena.mapped_size); else
+#endif
+    {
+        free(arena.packed);
+        free(arena.unused);
+        free(arena.used_count);
+    }
+    memset(&arena, 0, sizeof(arena));
+}
+
+#if SCORING!=SCORE_HISTOGRAM
+PRIVATE void formula_symbols(formula f, mask *symbols) {
+    int i;
+    for(i=0; i<SIZE; ++i) symbols[i] = SYMBOL(f, i);
+}
+#endif
 
-typedef struct formula {
-    masks           _symbols;
-#define symbols _symbols.masks
-    mask            unused;
-    unsigned char   used_count;
-} formula;
+PRIVATE void formula_to_buffer(formula f, char *buffer) {
+    int i;
+    for(i=0; i<SIZE; ++i) buffer[i] = mask_to_char(SYMBOL(f, i));
+}
 
-PRIVATE ARRAY_DECL(formula *, formulae);
+PRIVATE ARRAY_DECL(formula, formulae);
 
 #ifdef _OPENMP
 PRIVATE int nthreads = 1;
 #endif
 
-PRIVATE void findall(rat *num) {
-    opt_rat T;  T.set = true;
-    T.val = *num;
-#ifdef NUMBLE
-    {
-        int split = Choice(SIZE - 2);
-        opt_rat U, V;  V.set = false;
-        solve(&T, expression, &U, 0, split, '=', term(&V, split+1, SIZE));
-    }
-#else
-    expression(&T, 0, SIZE);
+#ifndef CBACK_FIBER                     /* Fiber() returns by itself */
+PRIVATE jmp_buf _env;
+PRAGMA_OMP(threadprivate(_env))
+PRIVATE void _return(void) {
+    longjmp(_env, 1);
+}
+#define _Backtracking(S) do {                       \
+    void (*_Fiasco)(void) = Fiasco;                 \
+    Fiasco = _return;                               \
+    if(!setjmp(_env)) do Backtracking(S) while(0);  \
+    else Fiasco = _Fiasco;                          \
+} while(0)
 #endif
 
-    {
-        int i, op = 0;
-        for(i=0; i<SIZE; ++i) {
-            switch(buffer[i]) {
-                case '+': case '-': case '*': case '/': ++op; break;
-                default: break;
-            }
-        }
-        if(op > MAX_OP) Backtrack();
+/* equations found by a findall() task, SIZE symbols each */
+typedef struct found_list {
+    char   *tab;
+    size_t len, capa;
+} found_list;
+
+/* where found() puts the equations when the arena is not to be used */
+PRIVATE found_list *found_in;
+PRAGMA_OMP(threadprivate(found_in))
+
+/* when set, found() only counts the equations there, by number of
+   distinct symbols */
+PRIVATE uint64_t *found_tally;
+
+#if STREAM_FINDALL
+/* equations handed by the enumerating threads to the one adding them to
+   the formulae: each thread fills a chunk of its own and links it to a
+   list once full (or once its part of the search is over), waking the
+   consumer up. The consumer frees a chunk once it has moved past it. */
+typedef struct stream_chunk {
+    struct stream_chunk *next;
+    size_t len;
+    char   tab[STREAM_CHUNK*SIZE];
+} stream_chunk;
+
+PRIVATE struct stream {
+    bool            on;
+    bool            done;   /* no more chunks will be linked */
+    stream_chunk    *tail;  /* last linked chunk */
+    stream_chunk    *head;  /* consumer: last consumed chunk */
+    pthread_mutex_t lock;   /* of done, tail and the links */
+    pthread_cond_t  ready;  /* a chunk was linked, or done set */
+    bool            hinted; /* hint holds a guess for least_worst() */
+    char            hint[SIZE]; /* last provisional guess */
+} stream = {
+    .lock  = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER
+};
+
+/* chunk being filled by a thread */
+PRIVATE stream_chunk *stream_fill;
+PRAGMA_OMP(threadprivate(stream_fill))
+
+PRIVATE stream_chunk *stream_chunk_new(void) {
+    stream_chunk *c = malloc(sizeof(stream_chunk));
+    assert(c != NULL);
+    c->next = NULL;
+    c->len  = 0;
+    return c;
+}
+
+PRIVATE void stream_init(void) {
+    stream.on   = true;
+    stream.done = false;
+    stream.hinted = false;
+    stream.head = stream.tail = stream_chunk_new();
+}
+
+PRIVATE void stream_link(stream_chunk *c) {
+    pthread_mutex_lock(&stream.lock);
+    stream.tail->next = c;
+    stream.tail = c;
+    pthread_cond_signal(&stream.ready);
+    pthread_mutex_unlock(&stream.lock);
+}
+
+PRIVATE void stream_add(const char *symbols) {
+    if(stream_fill == NULL) stream_fill = stream_chunk_new();
+    memcpy(stream_fill->tab + stream_fill->len*SIZE, symbols, SIZE);
+    if(++stream_fill->len == STREAM_CHUNK) {
+        stream_link(stream_fill);
+        stream_fill = NULL;
     }
+}
 
-    {
-        formula *f = 
-#if defined(__SSE4_1__)
-#define ALIGN (sizeof(SIMD_TYPE))
-            aligned_alloc(ALIGN, ((sizeof(formula)+ALIGN-1)/ALIGN)*ALIGN);
+/* links the chunk of the calling thread, when it is done enumerating */
+PRIVATE void stream_flush(void) {
+    if(stream_fill != NULL) {
+        stream_link(stream_fill);
+        stream_fill = NULL;
+    }
+}
+
+PRIVATE void stream_close(void) {
+    stream_flush();
+    pthread_mutex_lock(&stream.lock);
+    stream.done = true;
+    pthread_cond_signal(&stream.ready);
+    pthread_mutex_unlock(&stream.lock);
+}
 #else
-            malloc(sizeof(formula));
+#define stream_flush()
 #endif
-        int i;
 
-        assert(f!=NULL);
-        memset(f, 0, sizeof(formula));
+#if STREAM_FINDALL
+#define STREAMING           stream.on
+#else
+#define STREAMING           false
+#endif
 
-        f->unused = MSKall;
-        for(i=0; i<SIZE; ++i) {
-            mask m = char_to_mask(buffer[i]);
-            f->symbols[i] =  m;
-            f->unused    &= ~m;
+/* adds the symbols of an equation to the formulae */
+PRIVATE void found_add(const char *symbols) {
+#if STREAM_FINDALL
+    if(stream.on) stream_add(symbols); else
+#endif
+    ARRAY_ADD(formulae, arena_add(symbols));
+}
+
+/* adds the equation in buffer to the formulae */
+PRIVATE void found(void) {
+    if(constraint.on || found_tally != NULL) {
+        mask used = MSKnone;
+        int i;
+        for(i=0; i<SIZE; ++i) used |= char_to_mask(buffer[i]);
+        if(constraint.required & ~used) return;
+        if(found_tally != NULL) {
+            PRAGMA_OMP(atomic)
+            ++found_tally[popcount(used)];
+            return;
         }
-        f->used_count  = popcount(MSKall ^ f->unused);
-        ARRAY_ADD(formulae, f);
     }
+    if(found_in != NULL) {
+        if(found_in->len + SIZE > found_in->capa) {
+            found_in->capa = found_in->capa ? 2*found_in->capa : 1024*SIZE;
+            found_in->tab  = realloc(found_in->tab, found_in->capa);
+            assert(found_in->tab != NULL);
+        }
+        memcpy(found_in->tab + found_in->len, buffer, SIZE);
+        found_in->len += SIZE;
+    } else found_add(buffer);
 
 #ifdef DEBUG
+    PRAGMA_OMP(critical(found))
 {
     static int num = 0; int i;
     for(i=0; i<SIZE; ++i) putchar(buffer[i]);
     printf("\t#%d\n", ++num);
 }
+#elif STREAM_FINDALL
+    PRAGMA_OMP(master)
+    if(!stream.on) progress(INT_MAX);
 #else
+    PRAGMA_OMP(master)
     progress(INT_MAX);
 #endif
+}
+
+/* the top-level choices of the grammar, explored independently: the
+   lone factor, then term * factor, term / factor, expression + term and
+   expression - term for each split (for Numble, the splits around '=') */
+#ifdef NUMBLE
+#define FINDALL_TASKS   (SIZE-2)
+#else
+#define FINDALL_TASKS   (1 + 4*(SIZE-2))
+#endif
+
+/* searches run: best-first, a single one choosing among the tasks so
+   that Merit orders all the equations */
+#define FINDALL_RUNS    (BEST_FIRST ? 1 : FINDALL_TASKS)
+
+/* not inlined: its locals must lie below the Dummy of Backtracking(),
+   in the part of the stack CBack saves and restores */
+NOINLINE void findall_task(rat *num, int task) {
+    opt_rat T, U, V;
+    T.set = true;  T.val = *num;
+    V.set = false;
+    ops   = 0;
+#if BEST_FIRST
+    written = MSKnone;
+    writes  = 0;
+    Merit   = 0;
+    task    = Choice(FINDALL_TASKS) - 1;
+#endif
+#ifdef NUMBLE
+    // the right hand side is the result, a plain number
+    solve(&T, expression, &U, 0, task+1, '=', number(&V, task+2, SIZE));
+#else
+    if(task == 0) {
+        factor(&T, 0, SIZE);
+    } else {
+        const int split = 1 + (task-1) % (SIZE-2);
+        switch((task-1) / (SIZE-2)) {
+            case 0: solve(&T, term, &U, 0, split, '*', factor(&V, split+1, SIZE)); break;
+            case 1: solve(&T, term, &U, 0, split, '/', factor(&V, split+1, SIZE)); break;
+            case 2: solve(&T, expression, &U, 0, split, '+', term(&V, split+1, SIZE)); break;
+            case 3: solve(&T, expression, &U, 0, split, '-', term(&V, split+1, SIZE)); break;
+        }
+    }
+#endif
 
+#if BEST_FIRST
+    Choice(1); /* yields to any better partial equation */
+#endif
+    found();
     Backtrack();
 }
 
-/*****************************************************************************/
+#ifdef CBACK_FIBER
+/* findall_task() on a fiber, which leaves it when the task is done */
+PRIVATE rat *fiber_num;
+PRIVATE int  fiber_task;
+PRAGMA_OMP(threadprivate(fiber_num, fiber_task))
+PRIVATE void findall_fiber(void) {
+    findall_task(fiber_num, fiber_task);
+}
+#endif
 
-typedef struct state {
-    masks   _impossible;
-#define impossible _impossible.masks
-    mask    mandatory;
-} state;
+/* the tasks are shared between the threads (when CBack allows it), and
+   their equations added in task order, as a single search would (when
+   streamed, in the order they come: they are sorted afterwards) */
+PRIVATE void findall(rat *num) {
+    found_list *lists = calloc(FINDALL_RUNS, sizeof(found_list));
+    int task;
+    size_t j;
 
-#ifdef DEBUG
-PRIVATE void state_print(state *state) {
-    int i;
-    printf("mandatory: "); mask_print(state->mandatory);
-    printf("\npossible:");
-    for(i=0; i<SIZE; ++i) {
-        printf(" ");
-        mask_print(MSKall ^ state->impossible[i]);
+    assert(lists != NULL);
+    bounds_init();
+    PRAGMA_OMP(parallel if(CBACK_THREADS))
+    {
+    PRAGMA_OMP(for schedule(dynamic, 1) nowait)
+    for(task=0; task<FINDALL_RUNS; ++task) {
+        /* streamed equations go straight to the consumer */
+        found_in = STREAMING ? NULL : &lists[task];
+        Notify(ops);
+#if BEST_FIRST
+        /* the branches are not resumed in order: the symbols written
+           by the one resumed must come back with it */
+        Notify(buffer);
+        Notify(written);
+        Notify(writes);
+#endif
+#ifdef CBACK_FIBER
+        fiber_num  = num;
+        fiber_task = task;
+        Fiber(findall_fiber);
+#else
+        _Backtracking(findall_task(num, task));
+#endif
+#if BEST_FIRST
+        RemoveNotification(&writes);
+        RemoveNotification(&written);
+        RemoveNotification(buffer);
+#endif
+        RemoveNotification(&ops);
+        found_in = NULL;
     }
-    printf("\n");
+    stream_flush();
+    }
+
+    for(task=0; task<FINDALL_RUNS; ++task) {
+        for(j=0; j<lists[task].len; j+=SIZE)
+            found_add(lists[task].tab + j);
+        free(lists[task].tab);
+    }
+    free(lists);
 }
-#endif
 
-PRIVATE void state_relax(state *s) {
-    mask possible = MSKnone;
-    int i;
+/*****************************************************************************/
 
-    for(i=0; i<SIZE; ++i) possible |= MSKall ^ s->impossible[i];
-    for(i=0; i<SIZE; ++i) {
-        mask m = MSKall ^ s->impossible[i];
-        if((m & -m)==m) s->impossible[i] = MSKall ^ possible;
-    }
-#ifdef DEBUG
-    printf("relaxed state:\n");
-    state_print(s);
-#endif
+/* same equations as findall(), found bottom-up: the values reachable by
+   each nonterminal depend on the width of its span, not on its position,
+   so they are computed once per width, each with the least number of
+   operators giving it and the rules producing it. The equations are
+   then rebuilt from the target by following these rules, the ones
+   needing more operators than left being skipped. */
+
+typedef struct {
+    int64_t p, q;       /* q>0 */
+} dp_val;
+
+/* values of a nonterminal for a width, numbers of that width excepted:
+   they are recognised arithmetically, and no other value of the same
+   width can be equal to them */
+typedef struct dp_set {
+    size_t   len, capa, slots;
+    dp_val   *vals;
+    uint8_t  *ops;      /* least operators for each value */
+    uint32_t *rules;    /* first rule giving each value */
+    uint32_t *index;    /* open addressing, 1+position in vals */
+} dp_set;
+
+/* values are designated by their position in their set, or by
+   DP_NUMBER plus their value for numbers */
+#define DP_NUMBER   0x80000000u
+#define DP_NONE     0xFFFFFFFFu
+
+/* one way of getting a value: a op b, with a of width split. op is 0
+   when the value comes from the nonterminal below (a designating it),
+   and '(' for a parenthesised expression. */
+typedef struct dp_rule {
+    uint32_t next;      /* next rule of the same value (0: none) */
+    uint32_t a, b;
+    char     op;
+    uint8_t  split;
+} dp_rule;
+
+enum { DP_E, DP_T, DP_F, DP_N, DP_NT }; /* expression, term, factor, number */
+
+#define DP_WIDTH (SIZE-2)               /* widest span below the equation */
+
+/* a nonterminal of width spanning buffer from pos which must be worth
+   the value ref, followed by the goals of next. need is the least number
+   of operators for this goal and the next ones. */
+typedef struct dp_goal {
+    int                   nt, width, pos;
+    uint32_t              ref;
+    int                   need;
+    const struct dp_goal *next;
+} dp_goal;
+
+PRIVATE dp_set  dp_sets[DP_NT][DP_WIDTH+1];
+PRIVATE int64_t dp_pow10[SIZE+1];
+PRIVATE struct {
+    size_t   len, capa;
+    dp_rule *tab;
+} dp_rules;
+
+PRIVATE int64_t gcd64(int64_t a, int64_t b) {
+    if(a < 0) a = -a;
+    if(b < 0) b = -b;
+    if(b) while ((a %= b) && (b %= a));
+    return a+b;
 }
 
-#define GREEN   0   /* must be 0 */
-#define YELLOW  1
-#define BLACK   2
+PRIVATE void dp_norm(dp_val *r, int64_t p, int64_t q) {
+    int64_t t = gcd64(p, q);
+    if(q < 0) t = -t;
+    r->p = p/t;
+    r->q = q/t;
+}
 
-PRIVATE void state_init(state *s) {
-    int i;
+PRIVATE bool dp_is_number(const dp_val *v, int w) {
+    return v->q==1 && v->p < dp_pow10[w]
+        && v->p >= (w==1 ? 0 : dp_pow10[w-1]);
+}
 
-    for(i=0; i<SIZE; ++i) s->impossible[i] = MSKnone;
-    s->mandatory  = MSKnone;
+PRIVATE size_t dp_hash(const dp_val *v) {
+    uint64_t h = v->p*0x9E3779B97F4A7C15ull ^ v->q*0xC2B2AE3D27D4EB4Full;
+    return h ^ (h >> 29);
 }
 
-PRIVATE bool state_update(state *st, mask *formula, int colors) {
-    mask yellow_ones = MSKnone;
-    mask forbidden   = MSKnone;
-    int i; div_t r;
+PRIVATE uint32_t dp_find(const dp_set *set, const dp_val *v) {
+    size_t h;
+    if(set->slots == 0) return DP_NONE;
+    for(h = dp_hash(v);; ++h) {
+        uint32_t i = set->index[h & (set->slots-1)];
+        if(i == 0) return DP_NONE;
+        if(set->vals[i-1].p == v->p && set->vals[i-1].q == v->q) return i-1;
+    }
+}
 
-    // update yellow
-    for(r.quot=colors, i=0; i<SIZE; ++i) {
-        r = div(r.quot, 3);
-        switch(r.rem) {
-            case YELLOW: {
-                mask m = formula[i];
-                st->impossible[i] |= m;
-                st->mandatory     |= m;
-                yellow_ones       |= m;
+/* value v of nonterminal nt for width w */
+PRIVATE uint32_t dp_ref(int nt, int w, const dp_val *v) {
+    return dp_is_number(v, w) ? DP_NUMBER | v->p : dp_find(&dp_sets[nt][w], v);
+}
+
+/* least operators for the value ref of nonterminal nt for width w */
+PRIVATE int dp_ops(int nt, int w, uint32_t ref) {
+    return (ref & DP_NUMBER) ? 0 : dp_sets[nt][w].ops[ref];
+}
+
+/* records that op applied to a and b gives v with ops operators */
+PRIVATE void dp_add(dp_set *set, const dp_val *v, int ops,
+    char op, int split, uint32_t a, uint32_t b) {
+    uint32_t i = dp_find(set, v);
+    dp_rule *rule;
+    size_t h;
+
+    if(i == DP_NONE) {
+        if(set->len == set->capa) {
+            set->capa  = set->capa ? 2*set->capa : 256;
+            set->vals  = realloc(set->vals,  set->capa*sizeof(*set->vals));
+            set->ops   = realloc(set->ops,   set->capa*sizeof(*set->ops));
+            set->rules = realloc(set->rules, set->capa*sizeof(*set->rules));
+            assert(set->vals!=NULL && set->ops!=NULL && set->rules!=NULL);
+        }
+        if(2*(set->len+1) > set->slots) {
+            size_t j;
+            free(set->index);
+            set->slots = set->slots ? 2*set->slots : 512;
+            set->index = calloc(set->slots, sizeof(*set->index));
+            assert(set->index!=NULL);
+            for(j=0; j<set->len; ++j) {
+                for(h = dp_hash(&set->vals[j]); set->index[h & (set->slots-1)]; ++h);
+                set->index[h & (set->slots-1)] = j+1;
             }
         }
+        for(h = dp_hash(v); set->index[h & (set->slots-1)]; ++h);
+        set->index[h & (set->slots-1)] = set->len+1;
+        i = set->len++;
+        set->vals[i]  = *v;
+        set->ops[i]   = ops;
+        set->rules[i] = 0;
+    } else if(ops < set->ops[i]) {
+        set->ops[i] = ops;
     }
 
-    // update green & find impossible ones
-    for(r.quot=colors, i=0; i<SIZE; ++i) {
-        mask m = formula[i];
-        r = div(r.quot, 3);
-        switch(r.rem) {
+    if(dp_rules.len == dp_rules.capa) {
+        dp_rules.capa = dp_rules.capa ? 2*dp_rules.capa : 4096;
+        dp_rules.tab  = realloc(dp_rules.tab, dp_rules.capa*sizeof(dp_rule));
+        assert(dp_rules.tab!=NULL && dp_rules.capa<DP_NONE);
+    }
+    if(dp_rules.len == 0) ++dp_rules.len; /* 0 ends the lists */
+    rule = &dp_rules.tab[dp_rules.len];
+    rule->next  = set->rules[i];
+    rule->a     = a;
+    rule->b     = b;
+    rule->op    = op;
+    rule->split = split;
+    set->rules[i] = dp_rules.len++;
+}
+
+/* rough number of values of nonterminal nt for width w */
+PRIVATE int64_t dp_count(int nt, int w) {
+    return dp_pow10[w] - (w==1 ? 0 : dp_pow10[w-1]) + dp_sets[nt][w].len;
+}
+
+/* runs the statements with V set to each value of nonterminal NT for
+   width W, OPS to the least operators giving it, and REF designating it */
+#define DP_EACH(NT, W, V, OPS, REF, ...) do {                       \
+    const dp_set *_set = &dp_sets[(NT)][(W)];                       \
+    dp_val V; int OPS; uint32_t REF; size_t _i;                     \
+    V.q = 1; OPS = 0; (void)OPS; (void)REF;                         \
+    for(V.p = (W)==1 ? 0 : dp_pow10[(W)-1]; V.p < dp_pow10[(W)]; ++V.p) { \
+        REF = DP_NUMBER | V.p;                                      \
+        __VA_ARGS__;                                                \
+    }                                                               \
+    for(_i = 0; _i < _set->len; ++_i) {                             \
+        V = _set->vals[_i]; OPS = _set->ops[_i]; REF = _i;          \
+        __VA_ARGS__;                                                \
+    }                                                               \
+} while(0)
+
+/* for Numble, the widest spans can only be the left side of '=', whose
+   right side is a number: their other values would never be joined */
+PRIVATE bool dp_joinable(int w, const dp_val *v) {
+#ifdef NUMBLE
+    if(w > DP_WIDTH-2)
+        return v->q==1 && v->p>=0 && v->p < dp_pow10[SIZE-1-w];
+#else
+    (void)w; (void)v;
+#endif
+    return true;
+}
+
+PRIVATE void dp_build(void) {
+    int w, s;
+
+    dp_pow10[0] = 1;
+    for(w=1; w<=SIZE; ++w) dp_pow10[w] = 10*dp_pow10[w-1];
+
+    for(w=1; w<=DP_WIDTH; ++w) {
+        dp_set * const F = &dp_sets[DP_F][w];
+        dp_set * const T = &dp_sets[DP_T][w];
+        dp_set * const E = &dp_sets[DP_E][w];
+        size_t i;
+        dp_val r;
+
+        // factor ::= ( expression )
+#if ALLOW_PARENTHESIS
+        if(w >= 3) DP_EACH(DP_E, w-2, v, o, ref,
+            dp_add(F, &v, o, '(', 0, ref, 0));
+#endif
+
+        // term ::= factor | term * factor | term / factor
+        for(i=0; i<F->len; ++i) dp_add(T, &F->vals[i], F->ops[i], 0, 0, i, 0);
+        for(s=1; s<w-1; ++s) DP_EACH(DP_T, s, u, ou, a,
+            if(ou < MAX_OP) DP_EACH(DP_F, w-s-1, v, ov, b,
+                if(ou + ov >= MAX_OP) continue;
+                dp_norm(&r, u.p * v.p, u.q * v.q);
+                if(dp_joinable(w, &r)) dp_add(T, &r, ou + ov + 1, '*', s, a, b);
+                if(v.p == 0) continue;
+                dp_norm(&r, u.p * v.q, u.q * v.p);
+                if(dp_joinable(w, &r)) dp_add(T, &r, ou + ov + 1, '/', s, a, b)));
+
+        // expression ::= term | expression + term | expression - term
+        for(i=0; i<T->len; ++i) dp_add(E, &T->vals[i], T->ops[i], 0, 0, i, 0);
+        for(s=1; s<w-1; ++s) DP_EACH(DP_E, s, u, ou, a,
+            if(ou < MAX_OP) DP_EACH(DP_T, w-s-1, v, ov, b,
+                if(ou + ov >= MAX_OP) continue;
+                dp_norm(&r, u.p * v.q + v.p * u.q, u.q * v.q);
+                if(dp_joinable(w, &r)) dp_add(E, &r, ou + ov + 1, '+', s, a, b);
+                dp_norm(&r, u.p * v.q - v.p * u.q, u.q * v.q);
+                if(dp_joinable(w, &r)) dp_add(E, &r, ou + ov + 1, '-', s, a, b)));
+    }
+}
+
+PRIVATE void dp_done(void) {
+    int nt, w;
+    for(nt=0; nt<DP_NT; ++nt) for(w=0; w<=DP_WIDTH; ++w) {
+        free(dp_sets[nt][w].vals);
+        free(dp_sets[nt][w].ops);
+        free(dp_sets[nt][w].rules);
+        free(dp_sets[nt][w].index);
+    }
+    memset(dp_sets, 0, sizeof(dp_sets));
+    free(dp_rules.tab);
+    memset(&dp_rules, 0, sizeof(dp_rules));
+}
+
+PRIVATE void dp_solve(const dp_goal *g, int budget);
+
+/* goal g rewritten as a op b, a being of nonterminal a_nt and width s */
+PRIVATE void dp_pair(const dp_goal *g, int budget, char op,
+    int a_nt, int s, uint32_t a, int b_nt, uint32_t b) {
+    const int rest = g->next ? g->next->need : 0;
+    const int cost = op=='=' ? 0 : 1;
+    dp_goal A, B;
+
+    B.nt = b_nt; B.width = g->width-s-1; B.pos = g->pos+s+1; B.ref = b;
+    A.nt = a_nt; A.width = s;            A.pos = g->pos;     A.ref = a;
+    B.need = dp_ops(b_nt, B.width, b) + rest;
+    A.need = dp_ops(a_nt, A.width, a) + B.need;
+    if(A.need + cost > budget) return;
+    B.next = g->next;
+    A.next = &B;
+    if(put(g->pos+s, op)) dp_solve(&A, budget - cost);
+}
+
+/* enumerates the ways of meeting the goals from g on with at most
+   budget operators */
+PRIVATE void dp_solve(const dp_goal *g, int budget) {
+    const dp_set *set;
+    uint32_t r;
+
+    if(g == NULL) {
+        found();
+        return;
+    }
+    if(g->ref & DP_NUMBER) {
+        if(num(g->ref & ~DP_NUMBER, g->pos, g->pos+g->width))
+            dp_solve(g->next, budget);
+        return;
+    }
+
+    set = &dp_sets[g->nt][g->width];
+    for(r = set->rules[g->ref]; r; r = dp_rules.tab[r].next) {
+        const dp_rule *rule = &dp_rules.tab[r];
+        dp_goal sub = *g;
+
+        switch(rule->op) {
+            case 0:
+            sub.nt  = g->nt+1;
+            sub.ref = rule->a;
+            sub.need = dp_ops(sub.nt, sub.width, sub.ref)
+                     + (g->next ? g->next->need : 0);
+            if(sub.need <= budget) dp_solve(&sub, budget);
+            break;
+
+            case '(':
+            sub.nt    = DP_E;
+            sub.width = g->width-2;
+            sub.pos   = g->pos+1;
+            sub.ref   = rule->a;
+            if(put(g->pos, '(') && put(g->pos+g->width-1, ')'))
+                dp_solve(&sub, budget);
+            break;
+
+            default:
+            dp_pair(g, budget, rule->op,
+                g->nt, rule->split, rule->a, g->nt+1, rule->b);
+            break;
+        }
+    }
+}
+
+/* the whole equation (a goal of width SIZE) is not in the sets: it is
+   split by enumerating the values of the smallest side, the other one
+   being deduced from the target v */
+PRIVATE void dp_right(const dp_goal *g, const dp_val *v, char op,
+    int a_nt, int s, const dp_val *a, uint32_t ra, int b_nt) {
+    const int r = g->width-s-1;
+    dp_val b;
+    uint32_t rb;
+
+    switch(op) {
+        case '=': b = *a; break;
+        case '+': dp_norm(&b, v->p*a->q - a->p*v->q, v->q*a->q); break;
+        case '-': dp_norm(&b, a->p*v->q - v->p*a->q, v->q*a->q); break;
+        case '*':
+        if(a->p == 0) {
+            if(v->p == 0) DP_EACH(b_nt, r, u, o, ref,
+                dp_pair(g, MAX_OP, op, a_nt, s, ra, b_nt, ref));
+            return;
+        }
+        dp_norm(&b, v->p*a->q, v->q*a->p);
+        break;
+        case '/':
+        if(a->p == 0) {
+            if(v->p == 0) DP_EACH(b_nt, r, u, o, ref, if(u.p)
+                dp_pair(g, MAX_OP, op, a_nt, s, ra, b_nt, ref));
+            return;
+        }
+        if(v->p == 0) return;
+        dp_norm(&b, a->p*v->q, a->q*v->p);
+        break;
+        default: assert(false); return;
+    }
+    if((rb = dp_ref(b_nt, r, &b)) != DP_NONE)
+        dp_pair(g, MAX_OP, op, a_nt, s, ra, b_nt, rb);
+}
+
+PRIVATE void dp_left(const dp_goal *g, const dp_val *v, char op,
+    int a_nt, int s, int b_nt, const dp_val *b, uint32_t rb) {
+    dp_val a;
+    uint32_t ra;
+
+    switch(op) {
+        case '=': a = *b; break;
+        case '+': dp_norm(&a, v->p*b->q - b->p*v->q, v->q*b->q); break;
+        case '-': dp_norm(&a, v->p*b->q + b->p*v->q, v->q*b->q); break;
+        case '*':
+        if(b->p == 0) {
+            if(v->p == 0) DP_EACH(a_nt, s, u, o, ref,
+                dp_pair(g, MAX_OP, op, a_nt, s, ref, b_nt, rb));
+            return;
+        }
+        dp_norm(&a, v->p*b->q, v->q*b->p);
+        break;
+        case '/':
+        if(b->p == 0) return;
+        dp_norm(&a, v->p*b->p, v->q*b->q);
+        break;
+        default: assert(false); return;
+    }
+    if((ra = dp_ref(a_nt, s, &a)) != DP_NONE)
+        dp_pair(g, MAX_OP, op, a_nt, s, ra, b_nt, rb);
+}
+
+PRIVATE void dp_split(const dp_goal *g, const dp_val *v, char op,
+    int a_nt, int s, int b_nt) {
+    const int r = g->width-s-1;
+    if(dp_count(a_nt, s) <= dp_count(b_nt, r)) {
+        DP_EACH(a_nt, s, a, o, ref,
+            dp_right(g, v, op, a_nt, s, &a, ref, b_nt));
+    } else {
+        DP_EACH(b_nt, r, b, o, ref,
+            dp_left(g, v, op, a_nt, s, b_nt, &b, ref));
+    }
+}
+
+#ifndef NUMBLE
+/* equations of nonterminal nt worth v */
+PRIVATE void dp_top(const dp_goal *g, int nt, const dp_val *v) {
+    int s;
+
+    switch(nt) {
+        case DP_E:
+        // expression ::= term | expression + term | expression - term
+        dp_top(g, DP_T, v);
+        for(s=1; s<SIZE-1; ++s) {
+            dp_split(g, v, '+', DP_E, s, DP_T);
+            dp_split(g, v, '-', DP_E, s, DP_T);
+        }
+        break;
+
+        case DP_T:
+        // term ::= factor | term * factor | term / factor
+        dp_top(g, DP_F, v);
+        for(s=1; s<SIZE-1; ++s) {
+            dp_split(g, v, '*', DP_T, s, DP_F);
+            dp_split(g, v, '/', DP_T, s, DP_F);
+        }
+        break;
+
+        case DP_F:
+        // factor ::= number | ( expression )
+        if(dp_is_number(v, SIZE) && num(v->p, 0, SIZE)) found();
+#if ALLOW_PARENTHESIS
+        {
+            dp_goal sub;
+            sub.nt = DP_E; sub.width = SIZE-2; sub.pos = 1;
+            sub.next = NULL;
+            if((sub.ref = dp_ref(DP_E, SIZE-2, v)) != DP_NONE
+            && (sub.need = dp_ops(DP_E, SIZE-2, sub.ref)) <= MAX_OP
+            && put(0, '(') && put(SIZE-1, ')')) dp_solve(&sub, MAX_OP);
+        }
+#endif
+        break;
+    }
+}
+#endif
+
+PRIVATE void dp_findall(rat *num) {
+    dp_goal top;
+    dp_val  v;
+
+    dp_build();
+    top.nt = DP_E; top.width = SIZE; top.pos = 0;
+    top.ref = DP_NONE; top.need = 0; top.next = NULL;
+    dp_norm(&v, num->p, num->q);
+#ifdef NUMBLE
+    {
+        int split;
+        for(split=1; split<SIZE-1; ++split)
+            dp_split(&top, &v, '=', DP_E, split, DP_N);
+    }
+#else
+    dp_top(&top, DP_E, &v);
+#endif
+    dp_done();
+}
+
+/*****************************************************************************/
+
+/* same equations again, by brute force: the grammar only decides where
+   the digits, operators and parentheses go, in a few skeletons. Each is
+   compiled once to a postfix program, then run over all the fillings of
+   its digits, SKEL_LANES of them at a time in loops the compiler turns
+   into SIMD code. When the last operation is an addition, subtraction
+   or '=' of a lone number, that number is not enumerated but computed
+   from the target. The values are unreduced fractions held in doubles:
+   with at most SIZE digits their terms stay below 10^SIZE, so for the
+   sizes played this is exact integer arithmetic. */
+#define SKEL_LANES      (256)
+
+typedef struct skeleton {
+    char    sym[SIZE];      /* 'n' where a digit goes */
+    char    prog[SIZE];     /* postfix, 'n' pushing the next number */
+    uint8_t len, ops;       /* of prog, operators (but '=') */
+} skeleton;
+
+PRIVATE ARRAY_DECL(skeleton, skeletons);
+PRIVATE struct {uint32_t first, len;} skel_of[DP_NT][SIZE+1], skel_top;
+
+/* appends the skeletons a op b, a from nt_a over wa and b from nt_b */
+PRIVATE void skel_combine(int nt_a, int wa, char op, int nt_b, int wb) {
+    uint32_t i, j;
+    for(i=0; i<skel_of[nt_a][wa].len; ++i)
+    for(j=0; j<skel_of[nt_b][wb].len; ++j) {
+        const skeleton *a = &skeletons.tab[skel_of[nt_a][wa].first + i];
+        const skeleton *b = &skeletons.tab[skel_of[nt_b][wb].first + j];
+        skeleton s;
+        s.ops = a->ops + b->ops + (op != '=');
+        if(s.ops > MAX_OP) continue;
+        memcpy(s.sym, a->sym, wa);
+        s.sym[wa] = op;
+        memcpy(s.sym + wa + 1, b->sym, wb);
+        memcpy(s.prog, a->prog, a->len);
+        memcpy(s.prog + a->len, b->prog, b->len);
+        s.len = a->len + b->len;
+        s.prog[s.len++] = op;
+        ARRAY_ADD(skeletons, s);
+    }
+}
+
+/* appends the skeletons of nt over w (already there) again */
+PRIVATE void skel_copy(int nt, int w) {
+    uint32_t i;
+    for(i=0; i<skel_of[nt][w].len; ++i) {
+        skeleton s = skeletons.tab[skel_of[nt][w].first + i];
+        ARRAY_ADD(skeletons, s);
+    }
+}
+
+PRIVATE void skel_build(void) {
+    int w, a;
+    if(skeletons.len) return;
+#define SKEL_RANGE(R, ...) do {                                     \
+    (R).first = skeletons.len; __VA_ARGS__;                         \
+    (R).len = skeletons.len - (R).first;                            \
+} while(0)
+    for(w=1; w<=SIZE; ++w) {
+        SKEL_RANGE(skel_of[DP_N][w], {
+            skeleton s;
+            memset(s.sym, 'n', w);
+            s.prog[0] = 'n'; s.len = 1; s.ops = 0;
+            ARRAY_ADD(skeletons, s);
+        });
+        SKEL_RANGE(skel_of[DP_F][w], {
+            skel_copy(DP_N, w);
+            if(ALLOW_PARENTHESIS && w >= 3) {
+                uint32_t i;
+                for(i=0; i<skel_of[DP_E][w-2].len; ++i) {
+                    skeleton s = skeletons.tab[skel_of[DP_E][w-2].first + i];
+                    memmove(s.sym + 1, s.sym, w-2);
+                    s.sym[0] = '('; s.sym[w-1] = ')';
+                    ARRAY_ADD(skeletons, s);
+                }
+            }
+        });
+        SKEL_RANGE(skel_of[DP_T][w], {
+            skel_copy(DP_F, w);
+            for(a=1; a<w-1; ++a) skel_combine(DP_T, a, '*', DP_F, w-a-1);
+            for(a=1; a<w-1; ++a) skel_combine(DP_T, a, '/', DP_F, w-a-1);
+        });
+        SKEL_RANGE(skel_of[DP_E][w], {
+            skel_copy(DP_T, w);
+            for(a=1; a<w-1; ++a) skel_combine(DP_E, a, '+', DP_T, w-a-1);
+            for(a=1; a<w-1; ++a) skel_combine(DP_E, a, '-', DP_T, w-a-1);
+        });
+    }
+#ifdef NUMBLE
+    // the right hand side is the result, a plain number
+    SKEL_RANGE(skel_top, for(a=1; a<SIZE-1; ++a)
+        skel_combine(DP_E, a, '=', DP_N, SIZE-a-1));
+#else
+    skel_top = skel_of[DP_E][SIZE];
+#endif
+#undef SKEL_RANGE
+}
+
+/* true when the last number of s is computed from the others */
+PRIVATE bool skel_solved(const skeleton *s) {
+    char op = s->prog[s->len-1];
+    return s->len > 1 && s->prog[s->len-2] == 'n'
+        && (op == '+' || op == '-' || op == '=');
+}
+
+/* runs the program of s over n lanes of numbers (but the last operation
+   when skel_solved()), leaving the values in p/q (q is 0 where a division
+   by zero occurred) */
+PRIVATE void skel_run(const skeleton *s, double num[][SKEL_LANES], int n,
+                      double *p, double *q) {
+    double P[SIZE][SKEL_LANES], Q[SIZE][SKEL_LANES];
+    int sp = 0, k = 0, pc, l, len = s->len;
+
+    if(skel_solved(s)) len -= 2;
+    for(pc=0; pc<len; ++pc) {
+        double *pa, *qa, *pb, *qb;
+        if(s->prog[pc] == 'n') {
+            memcpy(P[sp], num[k++], n*sizeof(double));
+            PRAGMA_OMP(simd)
+            for(l=0; l<n; ++l) Q[sp][l] = 1;
+            ++sp;
+            continue;
+        }
+        --sp;
+        pa = P[sp-1]; qa = Q[sp-1]; pb = P[sp]; qb = Q[sp];
+        switch(s->prog[pc]) {
+            case '+':
+            PRAGMA_OMP(simd)
+            for(l=0; l<n; ++l) {pa[l] = pa[l]*qb[l] + pb[l]*qa[l]; qa[l] *= qb[l];}
+            break;
+
+            case '-':
+            PRAGMA_OMP(simd)
+            for(l=0; l<n; ++l) {pa[l] = pa[l]*qb[l] - pb[l]*qa[l]; qa[l] *= qb[l];}
+            break;
+
+            case '*':
+            PRAGMA_OMP(simd)
+            for(l=0; l<n; ++l) {pa[l] *= pb[l]; qa[l] *= qb[l];}
+            break;
+
+            case '/':
+            PRAGMA_OMP(simd)
+            for(l=0; l<n; ++l) {
+                double t = pa[l]*qb[l];
+                qa[l] = pb[l]*qb[l]==0 ? 0 : qa[l]*pb[l];
+                pa[l] = t;
+            }
+            break;
+
+            default: assert(false);
+        }
+    }
+    memcpy(p, P[0], n*sizeof(double));
+    memcpy(q, Q[0], n*sizeof(double));
+}
+
+/* writes the digits of v (an integer) right-aligned before to, false if
+   one of them is forbidden there */
+PRIVATE bool skel_digits(char *symbols, double v, int to) {
+    int64_t n = (int64_t)v;
+    do {
+        char c = '0' + n%10;
+        --to;
+        if(constraint.on && (constraint.forbidden[to] & char_to_mask(c)))
+            return false;
+        symbols[to] = c;
+        n /= 10;
+    } while(n);
+    return true;
+}
+
+/* evaluates the batch of numbers against the target tp/tq and reports
+   the equations matching it */
+PRIVATE void skel_flush(const skeleton *s, double num[][SKEL_LANES], int n,
+                        const int *ends, int nums, double tp, double tq) {
+    double p[SKEL_LANES], q[SKEL_LANES], lo = 0, hi = 1;
+    bool   solved = skel_solved(s);
+    int    l, k;
+
+    skel_run(s, num, n, p, q);
+    if(solved) {
+        /* the last number is the target less the rest (for '+') */
+        double sign = s->prog[s->len-1] == '+' ? 1 : -1;
+        for(k=0; k<SIZE && s->sym[ends[nums-1]-1-k] == 'n'; ++k) hi *= 10;
+        lo = k>1 ? hi/10 : 0;
+        PRAGMA_OMP(simd)
+        for(l=0; l<n; ++l) {
+            double v = sign*(tp*q[l] - p[l]*tq) / (q[l]*tq);
+            p[l] = q[l]!=0 && v==floor(v) && v>=lo && v<hi ? v : -1;
+        }
+    } else {
+        PRAGMA_OMP(simd)
+        for(l=0; l<n; ++l) p[l] = q[l]!=0 && p[l]*tq==q[l]*tp ? 0 : -1;
+    }
+    for(l=0; l<n; ++l) if(p[l] >= 0) {
+        memcpy(buffer, s->sym, SIZE);
+        for(k=0; k<nums-solved; ++k) skel_digits(buffer, num[k][l], ends[k]);
+        if(solved && !skel_digits(buffer, p[l], ends[nums-1])) continue;
+        found();
+    }
+}
+
+/* enumerates the fillings of the digits of s allowed by the constraint
+   (but those of a computed last number) */
+PRIVATE void skel_fill(const skeleton *s, double tp, double tq) {
+    double num[SIZE][SKEL_LANES], cur[SIZE], wt[SIZE];
+    char   dig[SIZE][10];
+    int    nd[SIZE], idx[SIZE], numof[SIZE], ends[SIZE];
+    int    slots = 0, nums = 0, pos, n = 0, k;
+
+    for(pos=0; pos<SIZE; ++pos) {
+        char c = s->sym[pos];
+        if(c != 'n') {
+            if(constraint.on && (constraint.forbidden[pos] & char_to_mask(c)))
+                return;
+            continue;
+        }
+        if(pos==0 || s->sym[pos-1]!='n') cur[nums++] = 0;
+        numof[slots] = nums-1;
+        ends[nums-1] = pos+1;
+        for(nd[slots]=0, k='0'; k<='9'; ++k) {
+            if(k=='0' && pos+1<SIZE && s->sym[pos+1]=='n'
+            && (pos==0 || s->sym[pos-1]!='n')) continue; /* leading zero */
+            if(constraint.on && (constraint.forbidden[pos] & char_to_mask(k)))
+                continue;
+            dig[slots][nd[slots]++] = k - '0';
+        }
+        if(nd[slots] == 0) return;
+        ++slots;
+    }
+    if(skel_solved(s))              /* the last number is computed */
+        while(slots && numof[slots-1] == nums-1) --slots;
+    if(s->len == 1) {               /* a lone number: the target or not */
+        if(tq!=1 || tp<(slots>1 ? ipow(10, slots-1) : 0)
+        || tp>=ipow(10, slots)) return;
+        memcpy(buffer, s->sym, SIZE);
+        if(skel_digits(buffer, tp, ends[0])) found();
+        return;
+    }
+    for(k=slots; --k>=0;) {
+        wt[k] = k+1<slots && numof[k+1]==numof[k] ? 10*wt[k+1] : 1;
+        idx[k] = 0;
+        cur[numof[k]] += dig[k][0]*wt[k];
+    }
+    for(;;) {
+        for(k=0; k<nums; ++k) num[k][n] = cur[k];
+        if(++n == SKEL_LANES) {skel_flush(s, num, n, ends, nums, tp, tq); n = 0;}
+        for(k=slots; --k>=0;) {
+            int old = dig[k][idx[k]];
+            if(++idx[k] < nd[k]) {
+                cur[numof[k]] += (dig[k][idx[k]] - old)*wt[k];
+                break;
+            }
+            idx[k] = 0;
+            cur[numof[k]] += (dig[k][0] - old)*wt[k];
+        }
+        if(k < 0) break;
+    }
+    if(n) skel_flush(s, num, n, ends, nums, tp, tq);
+}
+
+/* the skeletons are shared between the threads and their equations
+   added in order, as in findall() */
+PRIVATE void skel_findall(rat *num) {
+    found_list *lists;
+    uint32_t i;
+    size_t j;
+
+    skel_build();
+    lists = calloc(skel_top.len, sizeof(found_list));
+    assert(lists != NULL);
+    PRAGMA_OMP(parallel)
+    {
+    PRAGMA_OMP(for schedule(dynamic, 1) nowait)
+    for(i=0; i<skel_top.len; ++i) {
+        found_in = STREAMING ? NULL : &lists[i];
+        skel_fill(&skeletons.tab[skel_top.first + i], num->p, num->q);
+        found_in = NULL;
+    }
+    stream_flush();
+    }
+    for(i=0; i<skel_top.len; ++i) {
+        for(j=0; j<lists[i].len; j+=SIZE)
+            found_add(lists[i].tab + j);
+        free(lists[i].tab);
+    }
+    free(lists);
+}
+
+/*****************************************************************************/
+
+/* index of the equations by value, built once for all the targets: a
+   header, the buckets sorted by value (plus a sentinel), then the packed
+   symbols of the equations of each bucket. Lone numbers are not stored,
+   they are recognised arithmetically as in the sets above. */
+#define INDEX_MAGIC "MTHLRIDX"
+
+typedef struct index_header {
+    char     magic[8];
+    int32_t  size, max_op;
+    double   min, max;          /* bounds of the values indexed */
+    uint64_t buckets, count;
+} index_header;
+
+typedef struct index_bucket {
+    int64_t  p, q;
+    uint64_t first;             /* first equation worth p/q */
+} index_bucket;
+
+/* a top-level rule of the equation, giving value v */
+typedef struct index_record {
+    dp_val   v;
+    uint32_t a, b, seq;
+    char     op;
+    uint8_t  split, a_nt, b_nt;
+} index_record;
+
+PRIVATE double index_min = -HUGE_VAL, index_max = HUGE_VAL;
+PRIVATE const char *index_file;     /* read by find_equations() */
+PRIVATE ARRAY_DECL(index_record, index_records);
+
+PRIVATE int index_cmp(const dp_val *u, const dp_val *v) {
+    const int64_t l = u->p * v->q, r = v->p * u->q;
+    return l<r ? -1 : l>r ? 1 : 0;
+}
+
+PRIVATE int index_record_cmp(const void *_a, const void *_b) {
+    const index_record *a = _a, *b = _b;
+    int c = index_cmp(&a->v, &b->v);
+    return c ? c : a->seq<b->seq ? -1 : a->seq>b->seq;
+}
+
+PRIVATE void index_add(int64_t p, int64_t q, char op,
+    int a_nt, int split, uint32_t a, int b_nt, uint32_t b) {
+    index_record r;
+    dp_norm(&r.v, p, q);
+    if(r.v.p < index_min*r.v.q || r.v.p > index_max*r.v.q) return;
+    r.a = a; r.b = b; r.seq = index_records.len;
+    r.op = op; r.split = split; r.a_nt = a_nt; r.b_nt = b_nt;
+    ARRAY_ADD(index_records, r);
+}
+
+/* the top-level rules of all the equations, but lone numbers */
+PRIVATE void index_rules(void) {
+    int s;
+#ifdef NUMBLE
+    // the right hand side is a number worth the left one
+    for(s=1; s<SIZE-1; ++s) DP_EACH(DP_E, s, u, ou, a,
+        if(dp_is_number(&u, SIZE-s-1))
+            index_add(0, 1, '=', DP_E, s, a, DP_N, DP_NUMBER | u.p));
+#else
+#if ALLOW_PARENTHESIS
+    // factor ::= ( expression )
+    DP_EACH(DP_E, SIZE-2, v, o, ref,
+        if(o <= MAX_OP) index_add(v.p, v.q, '(', DP_E, 0, ref, 0, 0));
+#endif
+    // term ::= term * factor | term / factor
+    for(s=1; s<SIZE-1; ++s) DP_EACH(DP_T, s, u, ou, a,
+        if(ou < MAX_OP) DP_EACH(DP_F, SIZE-s-1, v, ov, b,
+            if(ou + ov >= MAX_OP) continue;
+            index_add(u.p * v.p, u.q * v.q, '*', DP_T, s, a, DP_F, b);
+            if(v.p != 0)
+            index_add(u.p * v.q, u.q * v.p, '/', DP_T, s, a, DP_F, b)));
+    // expression ::= expression + term | expression - term
+    for(s=1; s<SIZE-1; ++s) DP_EACH(DP_E, s, u, ou, a,
+        if(ou < MAX_OP) DP_EACH(DP_T, SIZE-s-1, v, ov, b,
+            if(ou + ov >= MAX_OP) continue;
+            index_add(u.p * v.q + v.p * u.q, u.q * v.q, '+', DP_E, s, a, DP_T, b);
+            index_add(u.p * v.q - v.p * u.q, u.q * v.q, '-', DP_E, s, a, DP_T, b)));
+#endif
+}
+
+/* puts the equations of record r in found_in */
+PRIVATE void index_expand(const index_record *r) {
+    dp_goal top;
+    top.nt = DP_E; top.width = SIZE; top.pos = 0;
+    top.ref = DP_NONE; top.need = 0; top.next = NULL;
+    if(r->op == '(') {
+        top.width = SIZE-2; top.pos = 1; top.ref = r->a;
+        top.need = dp_ops(DP_E, SIZE-2, r->a);
+        buffer[0] = '(';
+        buffer[SIZE-1] = ')';
+        dp_solve(&top, MAX_OP);
+    } else dp_pair(&top, MAX_OP, r->op, r->a_nt, r->split, r->a, r->b_nt, r->b);
+}
+
+PRIVATE void index_fail(const char *path, FILE *f) {
+    perror(path);
+    if(f!=NULL) fclose(f);
+    exit(EXIT_FAILURE);
+}
+
+/* enumerates all the equations and writes them by value to path */
+PRIVATE void index_write(const char *path) {
+    FILE *f = fopen(path, "wb");
+    index_header hdr;
+    index_bucket *buckets;
+    found_list list = {NULL, 0, 0};
+    size_t i, j, n;
+    int t;
+
+    if(f==NULL) index_fail(path, f);
+    printf("Indexing equations..."); fflush(stdout);
+    progress(-1);
+    dp_build();
+    index_rules();
+    qsort(index_records.tab, index_records.len, sizeof(index_record),
+        index_record_cmp);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.size = SIZE; hdr.max_op = MAX_OP;
+    hdr.min  = index_min; hdr.max = index_max;
+    for(i=0; i<index_records.len; ++i) hdr.buckets += i==0
+        || index_cmp(&index_records.tab[i-1].v, &index_records.tab[i].v);
+    buckets = calloc(hdr.buckets+1, sizeof(index_bucket));
+    assert(buckets!=NULL);
+    if(fseek(f, sizeof(hdr) + (hdr.buckets+1)*sizeof(index_bucket), SEEK_SET))
+        index_fail(path, f);
+
+    found_in = &list;
+    for(i=n=0; i<index_records.len; i=j, ++n) {
+        size_t k;
+        buckets[n].p = index_records.tab[i].v.p;
+        buckets[n].q = index_records.tab[i].v.q;
+        buckets[n].first = hdr.count;
+        list.len = 0;
+        for(j=i; j<index_records.len
+        && !index_cmp(&index_records.tab[i].v, &index_records.tab[j].v); ++j)
+            index_expand(&index_records.tab[j]);
+        for(k=0; k<list.len; k+=SIZE) {
+            uint32_t packed = symbols_pack(list.tab + k);
+            if(fwrite(&packed, sizeof(packed), 1, f)!=1) index_fail(path, f);
+        }
+        hdr.count += list.len/SIZE;
+    }
+    found_in = NULL;
+    buckets[n].first = hdr.count;
+
+    rewind(f);
+    if(fwrite(&hdr, sizeof(hdr), 1, f)!=1
+    || fwrite(buckets, sizeof(index_bucket), n+1, f)!=n+1
+    || fclose(f)) index_fail(path, NULL);
+
+    t = progress(0);
+    printf("done ("); if(t>1) printf("%s%d%s secs, ", A_BOLD, t, A_NORM);
+    printf("%s%'llu%s equations for %s%'llu%s values)\n",
+        A_BOLD, (unsigned long long)hdr.count, A_NORM,
+        A_BOLD, (unsigned long long)hdr.buckets, A_NORM);
+    free(list.tab);
+    free(buckets);
+    ARRAY_DONE(index_records);
+    dp_done();
+}
+
+/* adds the equations worth target found in the index at path. Returns
+   false if the index does not cover it. */
+PRIVATE bool index_read(const char *path, rat *target) {
+    FILE *f = fopen(path, "rb");
+    index_header hdr;
+    index_bucket bucket;
+    uint64_t lo, hi, mid;
+    dp_val v;
+
+    if(f==NULL) index_fail(path, f);
+    if(fread(&hdr, sizeof(hdr), 1, f)!=1
+    || memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic))
+    || hdr.size!=SIZE || hdr.max_op!=MAX_OP) {
+        printf("%s is not an index for this game...", path);
+        fclose(f);
+        return false;
+    }
+    dp_norm(&v, target->p, target->q);
+    if(v.p < hdr.min*v.q || v.p > hdr.max*v.q) {
+        printf("%s does not cover this target...", path);
+        fclose(f);
+        return false;
+    }
+
+#ifndef NUMBLE
+    if(v.q==1 && v.p>=0 && num(v.p, 0, SIZE))
+        ARRAY_ADD(formulae, arena_add(buffer));
+#endif
+    for(lo=0, hi=hdr.buckets; lo<hi;) {
+        dp_val u;
+        mid = lo + (hi-lo)/2;
+        if(fseek(f, sizeof(hdr) + mid*sizeof(bucket), SEEK_SET)
+        || fread(&bucket, sizeof(bucket), 1, f)!=1) index_fail(path, f);
+        u.p = bucket.p; u.q = bucket.q;
+        if(index_cmp(&u, &v) < 0) lo = mid+1; else hi = mid;
+    }
+    if(lo < hdr.buckets
+    && !fseek(f, sizeof(hdr) + lo*sizeof(bucket), SEEK_SET)
+    && fread(&bucket, sizeof(bucket), 1, f)==1
+    && bucket.p==v.p && bucket.q==v.q) {
+        uint64_t first = bucket.first;
+        uint32_t packed;
+        if(fread(&bucket, sizeof(bucket), 1, f)!=1
+        || fseek(f, sizeof(hdr) + (hdr.buckets+1)*sizeof(bucket)
+                  + first*sizeof(packed), SEEK_SET)) index_fail(path, f);
+        for(; first<bucket.first; ++first) {
+            if(fread(&packed, sizeof(packed), 1, f)!=1) index_fail(path, f);
+            ARRAY_ADD(formulae, arena_add_packed(packed));
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+/*****************************************************************************/
+
+/* counting only: the equations are enumerated as usual, but found()
+   just tallies them by number of distinct symbols (the USED_COUNT()
+   the scoring filters its candidates on), keeping nothing. This sizes
+   a game before playing it, or the whole variant offline. */
+
+PRIVATE void count_header(void) {
+    int k;
+    printf("# value\tequations");
+    for(k=1; k<=SIZE; ++k) printf("\t%d symb.", k);
+    putchar('\n');
+}
+
+PRIVATE uint64_t count_print(int64_t p, int64_t q, const uint64_t *tally) {
+    uint64_t n = 0;
+    int k;
+    for(k=1; k<=SIZE; ++k) n += tally[k];
+    if(q == 1) printf("%lld", (long long)p);
+    else       printf("%lld/%lld", (long long)p, (long long)q);
+    printf("\t%llu", (unsigned long long)n);
+    for(k=1; k<=SIZE; ++k) printf("\t%llu", (unsigned long long)tally[k]);
+    putchar('\n');
+    return n;
+}
+
+/* counts the equations worth target in tally[0..SIZE] by number of
+   distinct symbols, returns their total */
+PRIVATE uint64_t count_equations(rat *target, uint64_t *tally) {
+    uint64_t n = 0;
+    int k;
+    memset(tally, 0, (SIZE+1)*sizeof(*tally));
+    found_tally = tally;
+    if(ENUMERATOR==ENUM_DP) dp_findall(target);
+    else if(ENUMERATOR==ENUM_SKELETON) skel_findall(target);
+    else findall(target);
+    found_tally = NULL;
+    for(k=0; k<=SIZE; ++k) n += tally[k];
+    return n;
+}
+
+/* prints the counts of every value between index_min and index_max,
+   lone numbers aside (as in the index) */
+PRIVATE void count_table(void) {
+    uint64_t tally[SIZE+1];
+    size_t i, j;
+
+    dp_build();
+    index_rules();
+    qsort(index_records.tab, index_records.len, sizeof(index_record),
+        index_record_cmp);
+    count_header();
+    found_tally = tally;
+    for(i=0; i<index_records.len; i=j) {
+        const dp_val v = index_records.tab[i].v;
+        memset(tally, 0, sizeof(tally));
+        for(j=i; j<index_records.len
+        && !index_cmp(&v, &index_records.tab[j].v); ++j)
+            index_expand(&index_records.tab[j]);
+        count_print(v.p, v.q, tally);
+    }
+    found_tally = NULL;
+    ARRAY_DONE(index_records);
+    dp_done();
+}
+
+/*****************************************************************************/
+
+#if FORMULA_DB
+/* the sorted formulae of a target are kept in a cache directory, with
+   the columns of the arena laid out so that the file can be mapped
+   read-only and used as the arena itself (the processes of a host then
+   share it). The header tells which build they are valid for. */
+#define DB_MAGIC        "MTHLRDB"
+#define DB_ALIGN(X)     (((X) + 63) & ~(size_t)63)
+
+typedef struct db_header {
+    char     magic[8];
+    uint32_t version;
+    int32_t  size, max_op, config;
+    char     variant[16];
+    int64_t  p, q;              /* target */
+    uint64_t count;
+    uint64_t checksum;          /* of the header, with 0 here, and columns */
+} db_header;
+
+/* offsets of the columns for count formulae, and size of the file */
+PRIVATE size_t db_layout(size_t count, size_t off[3]) {
+    off[0] = DB_ALIGN(sizeof(db_header));
+    off[1] = off[0] + DB_ALIGN(count*sizeof(uint32_t) + 64);
+    off[2] = off[1] + DB_ALIGN(count*sizeof(mask) + 64);
+    return   off[2] + DB_ALIGN(count*sizeof(unsigned char) + 64);
+}
+
+PRIVATE uint64_t db_checksum(uint64_t h, const void *ptr, size_t len) {
+    const unsigned char *p = ptr;
+    while(len--) h = (h ^ *p++) * 0x100000001B3ull;
+    return h;
+}
+
+/* of the header and of the columns, which are used as the arena: a
+   single pass over them, much cheaper than enumerating them again */
+PRIVATE uint64_t db_file_checksum(const db_header *hdr, const uint32_t *packed,
+    const mask *unused, const unsigned char *used_count) {
+    size_t n = hdr->count;
+    db_header h;
+    uint64_t r;
+    memcpy(&h, hdr, sizeof(h));
+    h.checksum = 0;
+    r = db_checksum(0xCBF29CE484222325ull, &h, sizeof(h));
+    r = db_checksum(r, packed, n*sizeof(*packed));
+    r = db_checksum(r, unused, n*sizeof(*unused));
+    return db_checksum(r, used_count, n*sizeof(*used_count));
+}
+
+PRIVATE void db_header_init(db_header *hdr, const dp_val *v, size_t count) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, DB_MAGIC, sizeof(hdr->magic));
+    hdr->version = FORMULA_DB_VERSION;
+    strncpy(hdr->variant, VARIANT, sizeof(hdr->variant)-1);
+    hdr->size   = SIZE;
+    hdr->max_op = MAX_OP;
+    hdr->config = CONFIG;
+    hdr->p      = v->p;
+    hdr->q      = v->q;
+    hdr->count  = count;
+}
+
+/* directory of the cache, created if needed: $MATHLER_CACHE, as the
+   cache is opt-in (one file per target, never pruned). Returns false if
+   there is none. */
+PRIVATE bool db_dir(char *dir, size_t len) {
+    const char *env = getenv("MATHLER_CACHE");
+
+    if(env == NULL || *env == '\0') return false;
+    snprintf(dir, len, "%s", env);
+    return mkdir(dir, 0755)==0 || errno==EEXIST;
+}
+
+PRIVATE bool db_path(char *path, size_t len, const dp_val *v) {
+    char dir[PATH_MAX-64];
+    if(!db_dir(dir, sizeof(dir))) return false;
+    snprintf(path, len, "%s/%s-%lld_%lld.db", dir, VARIANT,
+        (long long)v->p, (long long)v->q);
+    return true;
+}
+
+/* maps the formulae of target from the cache as the arena */
+PRIVATE bool db_load(rat *target) {
+    char path[PATH_MAX];
+    const db_header *hdr;
+    db_header expected;
+    struct stat st;
+    size_t off[3], i;
+    void *ptr;
+    dp_val v;
+    int fd;
+
+    dp_norm(&v, target->p, target->q);
+    if(!db_path(path, sizeof(path), &v)
+    || (fd = open(path, O_RDONLY))<0) return false;
+    if(fstat(fd, &st)<0 || (size_t)st.st_size < sizeof(db_header)
+    || MAP_FAILED == (ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))) {
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    hdr = ptr;
+    db_header_init(&expected, &v, hdr->count);
+    expected.checksum = hdr->checksum;
+    if(memcmp(hdr, &expected, sizeof(expected))
+    || hdr->count >= UINT32_MAX
+    || db_layout(hdr->count, off) != (size_t)st.st_size
+    || hdr->checksum != db_file_checksum(hdr,
+            (void*)((char*)ptr + off[0]), (void*)((char*)ptr + off[1]),
+            (void*)((char*)ptr + off[2]))) {
+        munmap(ptr, st.st_size);
+        return false;
+    }
+
+    arena_done();
+    arena.packed      = (void*)((char*)ptr + off[0]);
+    arena.unused      = (void*)((char*)ptr + off[1]);
+    arena.used_count  = (void*)((char*)ptr + off[2]);
+    arena.len         = arena.capa = hdr->count;
+    arena.mapped      = ptr;
+    arena.mapped_size = st.st_size;
+
+    _ARRAY_PTR(&formulae, formulae.len = arena.len);
+    for(i=0; i<arena.len; ++i) formulae.tab[i] = i;
+    return true;
+}
+
+/* stores the arena, which must hold the sorted formulae of target in
+   order, into the cache. Failures only mean there is no cache. */
+PRIVATE void db_save(rat *target) {
+    static const char zero[64];
+    char path[PATH_MAX], temp[PATH_MAX+8];
+    db_header hdr;
+    size_t off[3], size;
+    dp_val v;
+    FILE *f;
+    int fd;
+
+    if(arena.mapped != NULL) return;
+    dp_norm(&v, target->p, target->q);
+    if(!db_path(path, sizeof(path), &v)) return;
+    snprintf(temp, sizeof(temp), "%s-XXXXXX", path);
+    if((fd = mkstemp(temp))<0) return;
+    if(fchmod(fd, 0644)<0 || (f = fdopen(fd, "wb"))==NULL) {
+        close(fd);
+        unlink(temp);
+        return;
+    }
+
+    size = db_layout(arena.len, off);
+    db_header_init(&hdr, &v, arena.len);
+    hdr.checksum = db_file_checksum(&hdr,
+        arena.packed, arena.unused, arena.used_count);
+#define DB_WRITE(PTR, LEN, END) do {                                \
+    size_t _n = (LEN), _pad = (END) - ftell(f) - _n;                \
+    if(fwrite((PTR), 1, _n, f)!=_n) goto fail;                      \
+    for(; _pad>0; _pad -= _n) {                                     \
+        _n = _pad<sizeof(zero) ? _pad : sizeof(zero);               \
+        if(fwrite(zero, 1, _n, f)!=_n) goto fail;                   \
+    }                                                               \
+} while(0)
+    DB_WRITE(&hdr,             sizeof(hdr),                    off[0]);
+    DB_WRITE(arena.packed,     arena.len*sizeof(uint32_t),     off[1]);
+    DB_WRITE(arena.unused,     arena.len*sizeof(mask),         off[2]);
+    DB_WRITE(arena.used_count, arena.len*sizeof(unsigned char), size);
+#undef DB_WRITE
+    if(fclose(f)==0 && rename(temp, path)==0) return;
+    unlink(temp);
+    return;
+
+fail:
+    fclose(f);
+    unlink(temp);
+}
+#endif
+
+/*****************************************************************************/
+
+typedef struct state {
+    masks   _impossible;
+#define impossible _impossible.masks
+    mask    mandatory;
+} state;
+
+#ifdef DEBUG
+PRIVATE void state_print(state *state) {
+    int i;
+    printf("mandatory: "); mask_print(state->mandatory);
+    printf("\npossible:");
+    for(i=0; i<SIZE; ++i) {
+        printf(" ");
+        mask_print(MSKall ^ state->impossible[i]);
+    }
+    printf("\n");
+}
+#endif
+
+PRIVATE void state_relax(state *s) {
+    mask possible = MSKnone;
+    int i;
+
+    for(i=0; i<SIZE; ++i) possible |= MSKall ^ s->impossible[i];
+    for(i=0; i<SIZE; ++i) {
+        mask m = MSKall ^ s->impossible[i];
+        if((m & -m)==m) s->impossible[i] = MSKall ^ possible;
+    }
+#ifdef DEBUG
+    printf("relaxed state:\n");
+    state_print(s);
+#endif
+}
+
+#define GREEN   0   /* must be 0 */
+#define YELLOW  1
+#define BLACK   2
+
+PRIVATE void state_init(state *s) {
+    int i;
+
+    for(i=0; i<SIZE; ++i) s->impossible[i] = MSKnone;
+    s->mandatory  = MSKnone;
+}
+
+/* makes the enumerators only generate the equations compatible with st
+   (none when NULL) */
+PRIVATE void constrain(const state *st) {
+    int i;
+    constraint.on = st!=NULL;
+    for(i=0; i<SIZE; ++i) constraint.forbidden[i] = st ? st->impossible[i] : MSKnone;
+    constraint.required = st ? st->mandatory : MSKnone;
+}
+
+PRIVATE bool state_update(state *st, mask *formula, int colors) {
+    mask yellow_ones = MSKnone;
+    mask forbidden   = MSKnone;
+    int i; div_t r;
+
+    // update yellow
+    for(r.quot=colors, i=0; i<SIZE; ++i) {
+        r = div(r.quot, 3);
+        switch(r.rem) {
+            case YELLOW: {
+                mask m = formula[i];
+                st->impossible[i] |= m;
+                st->mandatory     |= m;
+                yellow_ones       |= m;
+            }
+        }
+    }
+
+    // update green & find impossible ones
+    for(r.quot=colors, i=0; i<SIZE; ++i) {
+        mask m = formula[i];
+        r = div(r.quot, 3);
+        switch(r.rem) {
             case GREEN:
 				// should not happen
                 //if(st->impossible[i] & m) return false;
@@ -875,145 +2671,1004 @@ PRIVATE bool state_update(state *st, mask *formula, int colors) {
         }
     }
 
-    // remove impossible ones
-    for(i=0; i<SIZE; ++i) {
-        mask m = MSKall ^ st->impossible[i];
-        if((m & -m) != m) {
-            st->impossible[i] |= forbidden;
+    // remove impossible ones
+    for(i=0; i<SIZE; ++i) {
+        mask m = MSKall ^ st->impossible[i];
+        if((m & -m) != m) {
+            st->impossible[i] |= forbidden;
+        }
+    }
+
+    return true;
+}
+
+PRIVATE bool state_compatible(state *state, formula f) {
+    if((state->mandatory & UNUSED(f))) { // bitwise and
+        return false; // some mandatory are not present
+    } else {
+        mask *imp = state->impossible, acc = MSKnone;
+        int i = 0;
+        do acc = (SYMBOL(f, i) & imp[i]); while(!acc && ++i<SIZE);
+        return acc==MSKnone;
+    }
+}
+
+/* for each symbol, the positions where the state forbids it. Together
+   with the packed symbols, it allows to test a formula with one table
+   lookup per nibble. */
+typedef struct state_table {
+    uint8_t impossible_at[SYMBOLS];
+    mask    mandatory;
+} state_table;
+
+PRIVATE void state_table_init(state_table *t, const state *state) {
+    int p;
+    memset(t->impossible_at, 0, sizeof(t->impossible_at));
+    for(p=0; p<SIZE; ++p) {
+        mask m;
+        for(m = state->impossible[p] & MSKall; m; m &= m-1)
+            t->impossible_at[ctz(m)] |= 1<<p;
+    }
+    t->mandatory = state->mandatory;
+}
+
+PRIVATE bool state_table_compatible(const state_table *t, formula f) {
+    uint32_t packed = arena.packed[f];
+    uint8_t  bad = 0;
+    int p;
+    if(t->mandatory & UNUSED(f)) return false;
+    for(p=0; p<SIZE; ++p, packed >>= 4)
+        bad |= t->impossible_at[packed & 15] & (1<<p);
+    return bad==0;
+}
+
+#define ALL_COLORS (SIZE==5 ? 243 : SIZE==6 ? 729 : SIZE==7 ? 2187 : 6561)
+
+#if SCORING==SCORE_HISTOGRAM || FEEDBACK_MATRIX || STREAM_FINDALL
+/* colors displayed by the game when "guess" is tried and "secret" is
+   the solution (same base 3 encoding as in state_update()) */
+PRIVATE int feedback(formula guess, formula secret) {
+    mask left[SIZE];
+    int  n = 0, colors = 0, i, j, w;
+
+    // greens first, remembering the unmatched symbols of the secret
+    for(i=0; i<SIZE; ++i) {
+        if(SYMBOL(guess, i) != SYMBOL(secret, i))
+            left[n++] = SYMBOL(secret, i);
+    }
+
+    // then yellows from left to right, each symbol being used once
+    for(i=0, w=1; i<SIZE; ++i, w*=3) {
+        mask m = SYMBOL(guess, i);
+        if(m == SYMBOL(secret, i)) continue;
+        for(j=0; j<n && left[j]!=m; ++j);
+        if(j<n) {
+            left[j] = MSKnone;
+            colors += YELLOW*w;
+        } else {
+            colors += BLACK*w;
+        }
+    }
+
+    return colors;
+}
+#endif
+
+#if FEEDBACK_MATRIX
+/* feedback codes of every formula (row) against every other (column)
+   of a set: the survivors of the first strict round, which later rounds
+   only narrow (or the whole universe with MATRIX_EAGER). matrix_slot[]
+   tells the row/column of a formula, -1 outside the set. */
+PRIVATE uint16_t *matrix;
+PRIVATE int32_t  *matrix_slot;
+PRIVATE size_t    matrix_len, matrix_size;
+PRIVATE bool      matrix_tried;
+
+PRIVATE void *matrix_alloc(size_t size) {
+#ifdef _WIN32
+    return size <= MATRIX_MAX_RAM ? malloc(size) : NULL;
+#else
+    void *ptr;
+    int fd = -1;
+
+    if(size > MATRIX_MAX_RAM) {
+        const char *dir = getenv("TMPDIR");
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof(path), "%s/mathler-XXXXXX", dir ? dir : "/tmp");
+        if((fd = mkstemp(path))<0) return NULL;
+        unlink(path);
+        /* blocks reserved now: a full disk (or tmpfs) would otherwise
+           only show up as a SIGBUS while writing through the map */
+        if(posix_fallocate(fd, 0, size)!=0) {
+            close(fd);
+            return NULL;
+        }
+    }
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        fd<0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+    if(fd>=0) close(fd);
+    return ptr==MAP_FAILED ? NULL : ptr;
+#endif
+}
+
+PRIVATE void matrix_done(void) {
+    if(matrix!=NULL) {
+#ifdef _WIN32
+        free(matrix);
+#else
+        munmap(matrix, matrix_size);
+#endif
+    }
+    free(matrix_slot);
+    matrix       = NULL;
+    matrix_slot  = NULL;
+    matrix_len   = 0;
+    matrix_size  = 0;
+    matrix_tried = false;
+}
+
+/* once per game: later calls keep the matrix of the first one */
+PRIVATE void matrix_build(formula *tab, int len) {
+    const int tiles = (len + MATRIX_TILE - 1)/MATRIX_TILE;
+    int t, done = 0;
+
+    if(matrix_tried) return;
+    matrix_tried = true;
+
+    matrix_len  = len;
+    matrix_size = matrix_len*matrix_len*sizeof(*matrix);
+    if(matrix_len<=1 || matrix_size > MATRIX_MAX_DISK
+    || NULL == (matrix_slot = malloc(arena.len*sizeof(*matrix_slot)))
+    || NULL == (matrix = matrix_alloc(matrix_size))) {
+        free(matrix_slot);
+        matrix_slot = NULL;
+        matrix_len = matrix_size = 0;
+        return;
+    }
+    memset(matrix_slot, -1, arena.len*sizeof(*matrix_slot));
+    for(t=0; t<len; ++t) matrix_slot[tab[t]] = t;
+
+    printf("Building feedback matrix (%s%'u%s MB)...",
+        A_BOLD, (unsigned)(matrix_size>>20), A_NORM);
+    fflush(stdout);
+
+    progress(-tiles*tiles);
+    PRAGMA_OMP(parallel for schedule(dynamic))
+    for(t=0; t<tiles*tiles; ++t) {
+        const int r0 = (t/tiles)*MATRIX_TILE, c0 = (t%tiles)*MATRIX_TILE;
+        const int r1 = r0+MATRIX_TILE<len ? r0+MATRIX_TILE : len;
+        const int c1 = c0+MATRIX_TILE<len ? c0+MATRIX_TILE : len;
+        int r, c;
+        for(r=r0; r<r1; ++r) {
+            uint16_t *row = matrix + r*matrix_len;
+            for(c=c0; c<c1; ++c)
+                row[c] = feedback(tab[r], tab[c]);
+        }
+        PRAGMA_OMP(critical)
+        progress(++done);
+    }
+    printf("done");
+    if((t=progress(0))>1) printf(" (%s%d%s secs)", A_BOLD, t, A_NORM);
+    printf("\n");
+}
+
+PRIVATE int feedback_of(formula guess, formula secret) {
+    int32_t r, c;
+    if(matrix==NULL || (r = matrix_slot[guess])<0 || (c = matrix_slot[secret])<0)
+        return feedback(guess, secret);
+    return matrix[r*matrix_len + c];
+}
+#else
+#define feedback_of feedback
+#endif
+
+#if BITSET_INDEX
+/* bit-sliced view of a formula table: for each position and symbol
+   (and for each symbol used anywhere), the set of formulae having it */
+typedef struct bitset_index {
+    size_t      len, words;
+    uint64_t    *at[SIZE][SYMBOLS];
+    uint64_t    *uses[SYMBOLS];
+    uint64_t    *all;
+    void        *mem;
+} bitset_index;
+
+PRIVATE bitset_index samples_index;
+PRAGMA_OMP(threadprivate(samples_index))
+
+PRIVATE void bitset_index_done(bitset_index *idx) {
+    if(idx->mem!=NULL) free(idx->mem);
+    memset(idx, 0, sizeof(*idx));
+}
+
+PRIVATE void bitset_index_build(bitset_index *idx, formula *tab, size_t len) {
+    const size_t words = (len+63)/64, bytes = words*sizeof(uint64_t);
+    const size_t count = (SIZE+1)*SYMBOLS + 1;
+    uint64_t *ptr;
+    size_t i;
+    int p, s;
+
+    if(idx->mem==NULL || idx->words<words) {
+        bitset_index_done(idx);
+        idx->mem = aligned_alloc(64, ((count*bytes+63)/64)*64);
+        assert(idx->mem!=NULL);
+    }
+    memset(idx->mem, 0, count*bytes);
+    idx->len   = len;
+    idx->words = words;
+
+    ptr = idx->mem;
+    for(p=0; p<SIZE; ++p) for(s=0; s<SYMBOLS; ++s, ptr += words)
+        idx->at[p][s] = ptr;
+    for(s=0; s<SYMBOLS; ++s, ptr += words)
+        idx->uses[s] = ptr;
+    idx->all = ptr;
+
+    for(i=0; i<len; ++i) {
+        const formula f = tab[i];
+        const uint64_t bit = 1ull<<(i&63);
+        const size_t   w   = i>>6;
+        mask used = MSKall ^ UNUSED(f);
+
+        for(p=0; p<SIZE; ++p) idx->at[p][NIBBLE(f, p)][w] |= bit;
+        for(; used; used &= used-1) idx->uses[ctz(used)][w] |= bit;
+        idx->all[w] |= bit;
+    }
+}
+
+/* the bitsets to combine in order to count the formulae of an index
+   compatible with a given state */
+typedef struct bitset_query {
+    const uint64_t  *all, *mand[SYMBOLS], *sets[SIZE*SYMBOLS];
+    size_t          words;
+    int             nmand, group[SIZE], ngroups;
+    bool            negate[SIZE];
+} bitset_query;
+
+PRIVATE void bitset_query_init(bitset_query *q,
+    const bitset_index *idx, const state *state) {
+    int nsets = 0, p, s;
+
+    q->all     = idx->all;
+    q->words   = idx->words;
+    q->nmand   = 0;
+    q->ngroups = 0;
+    for(s=0; s<SYMBOLS; ++s) if(state->mandatory & (1<<s))
+        q->mand[q->nmand++] = idx->uses[s];
+
+    for(p=0; p<SIZE; ++p) {
+        mask imp = MSKall & state->impossible[p], pos = MSKall ^ imp, m;
+        bool neg = popcount(imp) < popcount(pos);
+        if(imp==MSKnone) continue;
+        for(m = neg ? imp : pos; m; m &= m-1)
+            q->sets[nsets++] = idx->at[p][ctz(m)];
+        q->negate[q->ngroups]  = neg;
+        q->group[q->ngroups++] = nsets;
+    }
+}
+
+/* each constrained position selects the formulae whose symbol there is
+   among the possible ones (or, if shorter, rejects the impossible ones);
+   the loops are plain enough to be vectorized for every target below */
+INLINE int bitset_query_count(const bitset_query *q, const int threshold) {
+    size_t w0;
+    int    n = 0;
+
+    for(w0=0; w0<q->words; w0+=BITSET_BLOCK) {
+        const int len = q->words-w0<BITSET_BLOCK ? q->words-w0 : BITSET_BLOCK;
+        uint64_t acc[BITSET_BLOCK], tmp[BITSET_BLOCK];
+        int i, j, g;
+
+        for(j=0; j<len; ++j) acc[j] = q->all[w0+j];
+        for(i=0; i<q->nmand; ++i) {
+            const uint64_t *b = q->mand[i] + w0;
+            for(j=0; j<len; ++j) acc[j] &= b[j];
+        }
+        for(i=g=0; g<q->ngroups; ++g) {
+            for(j=0; j<len; ++j) tmp[j] = 0;
+            for(; i<q->group[g]; ++i) {
+                const uint64_t *b = q->sets[i] + w0;
+                for(j=0; j<len; ++j) tmp[j] |= b[j];
+            }
+            if(q->negate[g]) for(j=0; j<len; ++j) acc[j] &= ~tmp[j];
+            else             for(j=0; j<len; ++j) acc[j] &=  tmp[j];
+        }
+        for(j=0; j<len; ++j) n += popcount64(acc[j]);
+        if(n>threshold) break;
+    }
+
+    return n;
+}
+
+#endif
+
+/*****************************************************************************/
+
+/* the hot kernels are compiled for several instruction sets and the
+   best one supported by the cpu is picked at startup (the MATHLER_SIMD
+   environment variable can force one of simd_names[] for benchmarks) */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_DISPATCH       1
+#include <immintrin.h>
+#define TARGET(ISA)         __attribute__((target(ISA)))
+#else
+#define SIMD_DISPATCH       0
+#define TARGET(ISA)
+#endif
+
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE4,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_LEVELS
+} simd_level;
+
+PRIVATE const char *simd_names[SIMD_LEVELS] = {
+    "scalar", "sse4", "avx2", "avx512"
+};
+
+typedef int (*compatible_count_kernel)(const state_table *t,
+    const int threshold, const formula *tab, int len);
+typedef void (*compatible_batch_kernel)(const state_table *t, int k,
+    int *counts, const formula *tab, int len);
+#if BITSET_INDEX
+typedef int (*bitset_count_kernel)(const bitset_query *q,
+    const int threshold);
+#endif
+
+PRIVATE int compatible_count_scalar(const state_table *t,
+    const int threshold, const formula *tab, int len) {
+    int n = 0;
+    while(--len>=0) {
+        if(state_table_compatible(t, tab[len])) {
+            if(++n>threshold) {
+                break;
+            }
+        }
+    }
+    return n;
+}
+
+/* adds to counts[j] the number of formulae compatible with t[j], for
+   j<k: each formula is decoded once for all the states */
+PRIVATE void compatible_batch_scalar(const state_table *t, int k,
+    int *counts, const formula *tab, int len) {
+    while(--len>=0) {
+        const uint32_t packed = arena.packed[tab[len]];
+        const mask     unused = UNUSED(tab[len]);
+        int j, p;
+        for(j=0; j<k; ++j) {
+            uint32_t v = packed;
+            uint8_t  bad = 0;
+            for(p=0; p<SIZE; ++p, v >>= 4)
+                bad |= t[j].impossible_at[v & 15] & (1<<p);
+            counts[j] += !bad && !(t[j].mandatory & unused);
         }
     }
+}
 
-    return true;
+#if SIMD_DISPATCH
+/* the packed symbols of each formula are looked up with pshufb: every
+   byte holds two nibbles, the low one at position 2k and the high one
+   at 2k+1, k being the byte number in the formula. Each lookup is masked
+   with the bit of its position and the mandatory symbols are checked
+   against the unused ones in the same vector. */
+TARGET("sse4.2,popcnt")
+PRIVATE int compatible_count_sse4(const state_table *t,
+    const int threshold, const formula *tab, int len) {
+    const __m128i tbl  = _mm_loadu_si128((const __m128i*)t->impossible_at);
+    const __m128i nib  = _mm_set1_epi8(15);
+    const __m128i plo  = _mm_set1_epi32(0x40100401);
+    const __m128i phi  = _mm_set1_epi32(0x80200802);
+    const __m128i mand = _mm_set1_epi32(t->mandatory);
+    const __m128i zero = _mm_setzero_si128();
+    int n = 0;
+
+    for(; len>=4; len-=4) {
+        const formula *f = tab + len - 4;
+        __m128i v = _mm_set_epi32(arena.packed[f[3]], arena.packed[f[2]],
+                                  arena.packed[f[1]], arena.packed[f[0]]);
+        __m128i u = _mm_set_epi32(UNUSED(f[3]), UNUSED(f[2]),
+                                  UNUSED(f[1]), UNUSED(f[0]));
+        __m128i lo = _mm_and_si128(v, nib);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nib);
+        __m128i bad = _mm_or_si128(
+            _mm_and_si128(_mm_shuffle_epi8(tbl, lo), plo),
+            _mm_and_si128(_mm_shuffle_epi8(tbl, hi), phi));
+        bad = _mm_or_si128(bad, _mm_and_si128(u, mand));
+        n += popcount(_mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpeq_epi32(bad, zero))));
+        if(n>threshold) return n;
+    }
+    return n + compatible_count_scalar(t, threshold-n, tab, len);
 }
 
-PRIVATE bool state_compatible(state *state, formula *formula) {
-    if((state->mandatory & formula->unused)) { // bitwise and
-        return false; // some mandatory are not present
-    } else {
-#ifdef SIMD_TYPE
-        int i = sizeof(formula->_symbols.vect)/sizeof(formula->_symbols.vect[0]);
-        SIMD_TYPE *imp = state->_impossible.vect;
-        SIMD_TYPE *sym = formula->_symbols.vect;
-        do {
-#if (CONFIG&16)
-#ifdef __SSE4_1__
-            if(!(_mm_test_all_zeros(*sym++, *imp++))) return false;
-#else
-            if((*imp++ & *sym++)) return false;
+/* same with 8 formulae gathered at once (the unused column is padded
+   so that reading 32 bits at the last 16-bit cell is fine) */
+TARGET("avx2,popcnt")
+PRIVATE int compatible_count_avx2(const state_table *t,
+    const int threshold, const formula *tab, int len) {
+    const __m256i tbl  = _mm256_broadcastsi128_si256(
+                            _mm_loadu_si128((const __m128i*)t->impossible_at));
+    const __m256i nib  = _mm256_set1_epi8(15);
+    const __m256i plo  = _mm256_set1_epi32(0x40100401);
+    const __m256i phi  = _mm256_set1_epi32(0x80200802);
+    const __m256i mand = _mm256_set1_epi32(t->mandatory);
+    const __m256i zero = _mm256_setzero_si256();
+    int n = 0;
+
+    for(; len>=8; len-=8) {
+        __m256i i = _mm256_loadu_si256((const __m256i*)(tab + len - 8));
+        __m256i v = _mm256_i32gather_epi32((const int*)arena.packed, i, 4);
+        __m256i u = _mm256_i32gather_epi32((const int*)arena.unused, i, 2);
+        __m256i lo = _mm256_and_si256(v, nib);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nib);
+        __m256i bad = _mm256_or_si256(
+            _mm256_and_si256(_mm256_shuffle_epi8(tbl, lo), plo),
+            _mm256_and_si256(_mm256_shuffle_epi8(tbl, hi), phi));
+        bad = _mm256_or_si256(bad, _mm256_and_si256(u, mand));
+        n += popcount(_mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpeq_epi32(bad, zero))));
+        if(n>threshold) return n;
+    }
+    return n + compatible_count_scalar(t, threshold-n, tab, len);
+}
+
+/* and 16 at once */
+TARGET("avx512f,avx512bw,popcnt")
+PRIVATE int compatible_count_avx512(const state_table *t,
+    const int threshold, const formula *tab, int len) {
+    const __m512i tbl  = _mm512_broadcast_i32x4(
+                            _mm_loadu_si128((const __m128i*)t->impossible_at));
+    const __m512i nib  = _mm512_set1_epi8(15);
+    const __m512i plo  = _mm512_set1_epi32(0x40100401);
+    const __m512i phi  = _mm512_set1_epi32(0x80200802);
+    const __m512i mand = _mm512_set1_epi32(t->mandatory);
+    int n = 0;
+
+    for(; len>=16; len-=16) {
+        __m512i i = _mm512_loadu_si512((const void*)(tab + len - 16));
+        __m512i v = _mm512_i32gather_epi32(i, (const void*)arena.packed, 4);
+        __m512i u = _mm512_i32gather_epi32(i, (const void*)arena.unused, 2);
+        __m512i lo = _mm512_and_si512(v, nib);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nib);
+        __m512i bad = _mm512_or_si512(
+            _mm512_and_si512(_mm512_shuffle_epi8(tbl, lo), plo),
+            _mm512_and_si512(_mm512_shuffle_epi8(tbl, hi), phi));
+        bad = _mm512_or_si512(bad, _mm512_and_si512(u, mand));
+        n += popcount(_mm512_testn_epi32_mask(bad, bad));
+        if(n>threshold) return n;
+    }
+    return n + compatible_count_scalar(t, threshold-n, tab, len);
+}
+
+/* batched versions: the nibbles are gathered once and tested against
+   each of the k tables */
+TARGET("sse4.2,popcnt")
+PRIVATE void compatible_batch_sse4(const state_table *t, int k,
+    int *counts, const formula *tab, int len) {
+    const __m128i nib  = _mm_set1_epi8(15);
+    const __m128i plo  = _mm_set1_epi32(0x40100401);
+    const __m128i phi  = _mm_set1_epi32(0x80200802);
+    const __m128i zero = _mm_setzero_si128();
+    int j;
+
+    for(; len>=4; len-=4) {
+        const formula *f = tab + len - 4;
+        __m128i v = _mm_set_epi32(arena.packed[f[3]], arena.packed[f[2]],
+                                  arena.packed[f[1]], arena.packed[f[0]]);
+        __m128i u = _mm_set_epi32(UNUSED(f[3]), UNUSED(f[2]),
+                                  UNUSED(f[1]), UNUSED(f[0]));
+        __m128i lo = _mm_and_si128(v, nib);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nib);
+        for(j=0; j<k; ++j) {
+            __m128i tbl = _mm_loadu_si128((const __m128i*)t[j].impossible_at);
+            __m128i bad = _mm_or_si128(
+                _mm_and_si128(_mm_shuffle_epi8(tbl, lo), plo),
+                _mm_and_si128(_mm_shuffle_epi8(tbl, hi), phi));
+            bad = _mm_or_si128(bad,
+                _mm_and_si128(u, _mm_set1_epi32(t[j].mandatory)));
+            counts[j] += popcount(_mm_movemask_ps(_mm_castsi128_ps(
+                _mm_cmpeq_epi32(bad, zero))));
+        }
+    }
+    compatible_batch_scalar(t, k, counts, tab, len);
+}
+
+TARGET("avx2,popcnt")
+PRIVATE void compatible_batch_avx2(const state_table *t, int k,
+    int *counts, const formula *tab, int len) {
+    const __m256i nib  = _mm256_set1_epi8(15);
+    const __m256i plo  = _mm256_set1_epi32(0x40100401);
+    const __m256i phi  = _mm256_set1_epi32(0x80200802);
+    const __m256i zero = _mm256_setzero_si256();
+    int j;
+
+    for(; len>=8; len-=8) {
+        __m256i i = _mm256_loadu_si256((const __m256i*)(tab + len - 8));
+        __m256i v = _mm256_i32gather_epi32((const int*)arena.packed, i, 4);
+        __m256i u = _mm256_i32gather_epi32((const int*)arena.unused, i, 2);
+        __m256i lo = _mm256_and_si256(v, nib);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nib);
+        for(j=0; j<k; ++j) {
+            __m256i tbl = _mm256_broadcastsi128_si256(
+                            _mm_loadu_si128((const __m128i*)t[j].impossible_at));
+            __m256i bad = _mm256_or_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(tbl, lo), plo),
+                _mm256_and_si256(_mm256_shuffle_epi8(tbl, hi), phi));
+            bad = _mm256_or_si256(bad,
+                _mm256_and_si256(u, _mm256_set1_epi32(t[j].mandatory)));
+            counts[j] += popcount(_mm256_movemask_ps(_mm256_castsi256_ps(
+                _mm256_cmpeq_epi32(bad, zero))));
+        }
+    }
+    compatible_batch_scalar(t, k, counts, tab, len);
+}
+
+TARGET("avx512f,avx512bw,popcnt")
+PRIVATE void compatible_batch_avx512(const state_table *t, int k,
+    int *counts, const formula *tab, int len) {
+    const __m512i nib  = _mm512_set1_epi8(15);
+    const __m512i plo  = _mm512_set1_epi32(0x40100401);
+    const __m512i phi  = _mm512_set1_epi32(0x80200802);
+    int j;
+
+    for(; len>=16; len-=16) {
+        __m512i i = _mm512_loadu_si512((const void*)(tab + len - 16));
+        __m512i v = _mm512_i32gather_epi32(i, (const void*)arena.packed, 4);
+        __m512i u = _mm512_i32gather_epi32(i, (const void*)arena.unused, 2);
+        __m512i lo = _mm512_and_si512(v, nib);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nib);
+        for(j=0; j<k; ++j) {
+            __m512i tbl = _mm512_broadcast_i32x4(
+                            _mm_loadu_si128((const __m128i*)t[j].impossible_at));
+            __m512i bad = _mm512_or_si512(
+                _mm512_and_si512(_mm512_shuffle_epi8(tbl, lo), plo),
+                _mm512_and_si512(_mm512_shuffle_epi8(tbl, hi), phi));
+            bad = _mm512_or_si512(bad,
+                _mm512_and_si512(u, _mm512_set1_epi32(t[j].mandatory)));
+            counts[j] += popcount(_mm512_testn_epi32_mask(bad, bad));
+        }
+    }
+    compatible_batch_scalar(t, k, counts, tab, len);
+}
 #endif
-#else
-#ifdef __SSE4_1__
-            if(!(_mm_test_all_zeros(sym[i-1], imp[i-1]))) return false;
-#else
-            if((imp[i-1] & sym[i-1])) return false;
+
+#if BITSET_INDEX
+PRIVATE int bitset_count_scalar(const bitset_query *q, const int threshold) {
+    return bitset_query_count(q, threshold);
+}
+#if SIMD_DISPATCH
+TARGET("sse4.2,popcnt")
+PRIVATE int bitset_count_sse4(const bitset_query *q, const int threshold) {
+    return bitset_query_count(q, threshold);
+}
+TARGET("avx2,popcnt")
+PRIVATE int bitset_count_avx2(const bitset_query *q, const int threshold) {
+    return bitset_query_count(q, threshold);
+}
+TARGET("avx512f,avx512bw,popcnt")
+PRIVATE int bitset_count_avx512(const bitset_query *q, const int threshold) {
+    return bitset_query_count(q, threshold);
+}
 #endif
 #endif
-        } while(--i);
-        return true;
-#else       
-        mask *sym = formula->symbols, *imp = state->impossible, acc = MSKnone;
-        int i = SIZE;
-        // do acc |= (*sym++ & *imp++); while(--i);
-        do acc = (*sym++ & *imp++); while(!acc && --i);
-        // do acc |= (*sym++ & *imp++); while(!acc && --i);
-        // for(i=0;i<SIZE;++i) acc |= sym[i] & imp[i];
-        return acc==MSKnone;
+
+PRIVATE struct {
+    simd_level              level;
+    compatible_count_kernel compatible_count;
+    compatible_batch_kernel compatible_batch;
+#if BITSET_INDEX
+    bitset_count_kernel     bitset_count;
+#endif
+} simd = {
+    SIMD_SCALAR,
+    compatible_count_scalar,
+    compatible_batch_scalar,
+#if BITSET_INDEX
+    bitset_count_scalar,
+#endif
+};
+
+PRIVATE void simd_init(void) {
+    const char *env = getenv("MATHLER_SIMD");
+    simd_level level = SIMD_SCALAR;
+    int i;
+
+#if SIMD_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        level = SIMD_SSE4;
+    if(level==SIMD_SSE4 && __builtin_cpu_supports("avx2"))
+        level = SIMD_AVX2;
+    if(level==SIMD_AVX2 && __builtin_cpu_supports("avx512f")
+                        && __builtin_cpu_supports("avx512bw"))
+        level = SIMD_AVX512;
 #endif
+    if(env!=NULL) {
+        for(i=0; i<SIMD_LEVELS && strcmp(env, simd_names[i]); ++i);
+        if(i<SIMD_LEVELS && i<=level) level = i;
+        else fprintf(stderr, "MATHLER_SIMD=%s unsupported, using %s.\n",
+            env, simd_names[level]);
+    }
+
+    simd.level = level;
+    switch(level) {
+#if SIMD_DISPATCH
+        case SIMD_AVX512:
+        simd.compatible_count = compatible_count_avx512;
+        simd.compatible_batch = compatible_batch_avx512;
+#if BITSET_INDEX
+        simd.bitset_count     = bitset_count_avx512;
+#endif
+        break;
+
+        case SIMD_AVX2:
+        simd.compatible_count = compatible_count_avx2;
+        simd.compatible_batch = compatible_batch_avx2;
+#if BITSET_INDEX
+        simd.bitset_count     = bitset_count_avx2;
+#endif
+        break;
+
+        case SIMD_SSE4:
+        simd.compatible_count = compatible_count_sse4;
+        simd.compatible_batch = compatible_batch_sse4;
+#if BITSET_INDEX
+        simd.bitset_count     = bitset_count_sse4;
+#endif
+        break;
+#endif
+
+        default:
+        simd.compatible_count = compatible_count_scalar;
+        simd.compatible_batch = compatible_batch_scalar;
+#if BITSET_INDEX
+        simd.bitset_count     = bitset_count_scalar;
+#endif
+        break;
     }
 }
 
-#if 1
 PRIVATE int state_compatible_count(
     state * const state, const int threshold,
-    formula ** const tab, const size_t len) {
-    int n = 0, i;
-    for(i=len; --i>=0;) {
-        if(state_compatible(state, tab[i])) {
-            if(++n>threshold) {
-                break;
-            }
+    formula * const tab, const size_t len) {
+    state_table t;
+    state_table_init(&t, state);
+    return simd.compatible_count(&t, threshold, tab, len);
+}
+
+#if BITSET_INDEX
+/* same as state_compatible_count() on the samples, but using wide
+   bitwise operations on their index */
+PRIVATE int bitset_index_count(const bitset_index *idx,
+    const state *state, const int threshold) {
+    bitset_query q;
+    bitset_query_init(&q, idx, state);
+    return simd.bitset_count(&q, threshold);
+}
+
+#define samples_count(STATE, THRESHOLD, TAB, LEN) \
+    bitset_index_count(&samples_index, (STATE), (THRESHOLD))
+#else
+#define samples_count state_compatible_count
+#endif
+
+#if STATE_CACHE
+/* compatible counts of the states met by find_worst(), which are often
+   the same for several color codes of a candidate (e.g. a black on an
+   already impossible symbol) or for similar candidates. The table is
+   direct mapped, shared by the threads through striped locks, and
+   only valid for one round of least_worst(), i.e. for one sample list
+   (it is not used when the samples are drawn at random). */
+typedef struct state_key {
+    uint16_t forbidden[SIZE];
+    uint16_t required;
+} state_key;
+
+typedef struct state_entry {
+    state_key key;
+    uint16_t  exact;    /* count is not a lower bound */
+    int       count;
+    unsigned  round;    /* entry is empty unless this is the current one */
+} state_entry;
+
+PRIVATE struct {
+    state_entry *tab;
+    unsigned     round;
+    bool         enabled;
+    struct {
+#ifdef _OPENMP
+        omp_lock_t lock;
+#endif
+        long long  lookups, hits;
+    } stripe[STATE_CACHE_LOCKS];
+} state_cache;
+
+PRIVATE void state_cache_done(void) {
+    int i;
+    if(state_cache.tab == NULL) return;
+    for(i=0; i<STATE_CACHE_LOCKS; ++i) {
+#ifdef _OPENMP
+        omp_destroy_lock(&state_cache.stripe[i].lock);
+#endif
+    }
+    free(state_cache.tab);
+    state_cache.tab = NULL;
+}
+
+/* starts a new round, in which the cache is used if enabled */
+PRIVATE void state_cache_round(bool enabled) {
+    int i;
+
+    if(state_cache.tab == NULL) {
+        state_cache.tab = calloc(1<<STATE_CACHE_BITS, sizeof(state_entry));
+        if(state_cache.tab == NULL) return;
+        for(i=0; i<STATE_CACHE_LOCKS; ++i) {
+#ifdef _OPENMP
+            omp_init_lock(&state_cache.stripe[i].lock);
+#endif
         }
     }
-    return n;
+    for(i=0; i<STATE_CACHE_LOCKS; ++i)
+        state_cache.stripe[i].lookups = state_cache.stripe[i].hits = 0;
+    ++state_cache.round;
+    state_cache.enabled = enabled;
+}
+
+/* percentage of hits in the current round (-1 if not used) */
+PRIVATE double state_cache_hits(void) {
+    long long lookups = 0, hits = 0;
+    int i;
+    for(i=0; i<STATE_CACHE_LOCKS; ++i) {
+        lookups += state_cache.stripe[i].lookups;
+        hits    += state_cache.stripe[i].hits;
+    }
+    return lookups ? (100.0*hits)/lookups : -1;
+}
+
+/* the masks are restricted to the real symbols, and a symbol is not
+   mandatory when it is the only one left at some position */
+PRIVATE uint32_t state_key_init(state_key *key, const state *state) {
+    uint32_t h = 2166136261u;
+    mask mandatory = state->mandatory & MSKall;
+    int i;
+
+    for(i=0; i<SIZE; ++i) {
+        mask m = MSKall ^ (state->impossible[i] & MSKall);
+        if((m & -m) == m) mandatory &= ~m;
+        key->forbidden[i] = MSKall ^ m;
+        h = (h ^ key->forbidden[i]) * 16777619u;
+    }
+    key->required = mandatory;
+    h = (h ^ mandatory) * 16777619u;
+    return h ^ (h >> 15);
 }
+
+PRIVATE state_entry *state_cache_lock(uint32_t hash) {
+    const int s = hash % STATE_CACHE_LOCKS;
+#ifdef _OPENMP
+    omp_set_lock(&state_cache.stripe[s].lock);
 #else
-PRIVATE int state_compatible_count(state *state, int threshold, formula **tab, size_t len) {
-    int n = 0, i;
-    for(i=len; i; ) switch(i) {
-        default:
-#define CODE if(state_compatible(state, tab[--i])) ++n
-        case 8: CODE; case 7: CODE; case 6: CODE; case 5: CODE;
-        case 4: CODE; case 3: CODE; case 2: CODE; case 1: CODE;
-        if(n>threshold) goto done;
-#undef CODE
+    (void)s;
+#endif
+    return &state_cache.tab[hash & ((1<<STATE_CACHE_BITS)-1)];
+}
+
+PRIVATE void state_cache_unlock(uint32_t hash) {
+#ifdef _OPENMP
+    omp_unset_lock(&state_cache.stripe[hash % STATE_CACHE_LOCKS].lock);
+#else
+    (void)hash;
+#endif
+}
+
+/* looks for the count of a state, only returned if it is exact or known
+   to be above the threshold */
+PRIVATE bool state_cache_find(const state_key *key, uint32_t hash,
+    int threshold, int *count) {
+    state_entry *e;
+    bool found;
+
+    if(!state_cache.enabled) return false;
+    e = state_cache_lock(hash);
+    ++state_cache.stripe[hash % STATE_CACHE_LOCKS].lookups;
+    found = e->round == state_cache.round
+         && !memcmp(&e->key, key, sizeof(*key))
+         && (e->exact || e->count > threshold);
+    if(found) {
+        *count = e->count;
+        ++state_cache.stripe[hash % STATE_CACHE_LOCKS].hits;
     }
-    done:
-    return n;
+    state_cache_unlock(hash);
+    return found;
+}
+
+/* remembers a count obtained with the given threshold */
+PRIVATE void state_cache_store(const state_key *key, uint32_t hash,
+    int threshold, int count) {
+    state_entry *e;
+
+    if(!state_cache.enabled) return;
+    e = state_cache_lock(hash);
+    e->key   = *key;
+    e->exact = count <= threshold;
+    e->count = count;
+    e->round = state_cache.round;
+    state_cache_unlock(hash);
 }
+
+/* COUNT = EXPR, the count of STATE, unless the cache already knows it */
+#define CACHED_COUNT(COUNT, STATE, THRESHOLD, EXPR) do {                \
+    state_key _key;                                                     \
+    uint32_t  _hash = state_key_init(&_key, (STATE));                   \
+    if(!state_cache_find(&_key, _hash, (THRESHOLD), &(COUNT))) {        \
+        (COUNT) = (EXPR);                                               \
+        state_cache_store(&_key, _hash, (THRESHOLD), (COUNT));          \
+    }                                                                   \
+} while(0)
+#else
+#define CACHED_COUNT(COUNT, STATE, THRESHOLD, EXPR) ((COUNT) = (EXPR))
 #endif
 
 /* find the worst number of incompatible states for the
    current candidate */
-#ifdef _OPENMP
-PRIVATE int find_worst_openmp(state *state, formula *candidate,
-    int all_colors, formula **tab, int len, int least_c) {
-    int worst = 0;
+#if SCORING==SCORE_HISTOGRAM
+PRIVATE int find_worst(state *state, formula candidate,
+    int all_colors, formula *tab, int len, int least_c) {
+    int hist[ALL_COLORS];
+    int worst = 0, i;
 
-    #pragma omp parallel shared(worst) firstprivate(least_c, tab, len)
-    {
-        int color = all_colors + omp_get_thread_num();
-#if 1
-        while((color-=nthreads)>=0 && worst<least_c) {
+    (void)state; // tab only holds formulae compatible with it
+    assert(all_colors == ALL_COLORS);
+    memset(hist, 0, sizeof(hist));
+
+    for(i=len; --i>=0;) {
+        int count = ++hist[feedback_of(candidate, tab[i])];
+        if(count > worst) {
+            worst = count;
+            if(worst > least_c) break;
+        }
+    }
+
+    return worst;
+}
+#elif SCORING==SCORE_DFS
+/* lists of formulae surviving at each depth of the walk */
+PRIVATE ARRAY_DECL(formula, dfs_lists);
+PRAGMA_OMP(threadprivate(dfs_lists))
+
+/* walks the color codes as a tree, one position at a time. A green or
+   a yellow already tells which symbol the formulae may have there, so
+   they are filtered on the way down (a black only matters once all the
+   yellows are known). A subtree is skipped as soon as its list cannot
+   beat the worst count found so far. */
+PRIVATE int dfs_worst(state *state, mask *symbols, int pos, int colors,
+    int weight, formula *list, int len, int worst, int least_c) {
+    if(pos == SIZE) {
+        struct state state2 = *state;
+        int count;
+
+        state_update(&state2, symbols, colors);
+        CACHED_COUNT(count, &state2, least_c,
+            state_compatible_count(&state2, least_c, list, len));
+        return count > worst ? count : worst;
+    } else {
+        const mask m = symbols[pos];
+        formula *next = list + len;
+        int i, n;
+
+        // green
+        for(i=n=0; i<len; ++i) if(SYMBOL(list[i], pos)==m) next[n++] = list[i];
+        if(n > worst) worst = dfs_worst(state, symbols, pos+1,
+            colors + GREEN*weight, weight*3, next, n, worst, least_c);
+        if(worst > least_c) return worst;
+
+        // yellow
+        for(i=n=0; i<len; ++i) if(SYMBOL(list[i], pos)!=m
+                              && !(UNUSED(list[i]) & m)) next[n++] = list[i];
+        if(n > worst) worst = dfs_worst(state, symbols, pos+1,
+            colors + YELLOW*weight, weight*3, next, n, worst, least_c);
+        if(worst > least_c) return worst;
+
+        // black
+        if(len > worst) worst = dfs_worst(state, symbols, pos+1,
+            colors + BLACK*weight, weight*3, list, len, worst, least_c);
+        return worst;
+    }
+}
+
+PRIVATE int find_worst(state *state, formula candidate,
+    int all_colors, formula *tab, int len, int least_c) {
+    mask symbols[SIZE];
+
+    (void)all_colors;
+    formula_symbols(candidate, symbols);
+    _ARRAY_PTR(&dfs_lists, (SIZE+1)*len);
+    memcpy(dfs_lists.tab, tab, len*sizeof(*tab));
+
+    return dfs_worst(state, symbols, 0, 0, 1, dfs_lists.tab, len, 0, least_c);
+}
+#elif !BITSET_INDEX
+/* the color codes are scored BATCH_STATES at a time against tiles of
+   BATCH_TILE samples, so that each tile is read from the cache rather
+   than from memory for all of them. A single count above least_c is
+   enough to reject the candidate, which is checked after each tile. */
+PRIVATE int find_worst(state *state, formula candidate,
+    int all_colors, formula *tab, int len, int least_c) {
+    mask        symbols[SIZE];
+    state_table tables[BATCH_STATES];
+    int         counts[BATCH_STATES];
+    int         colors, worst = 0;
+
+    formula_symbols(candidate, symbols);
+    for(colors=all_colors; colors>0;) {
+        int from, k, j;
+#if STATE_CACHE
+        state_key keys[BATCH_STATES];
+        uint32_t  hashes[BATCH_STATES];
+#endif
+
+        for(k=0; k<BATCH_STATES && colors>0;) {
             struct state state2 = *state;
-            state_update(&state2, candidate->symbols, color);
-            int count = state_compatible_count(&state2, least_c, tab, len);
-            if(count>worst) {
-                #pragma omp critical
-                {
-                    if(count>worst) worst = count;
-                }
+            state_update(&state2, symbols, --colors);
+#if STATE_CACHE
+            /* known states, and the ones already in the batch, are not
+               counted again */
+            hashes[k] = state_key_init(&keys[k], &state2);
+            if(state_cache_find(&keys[k], hashes[k], least_c, &counts[k])) {
+                if(counts[k] > least_c) return counts[k];
+                if(counts[k] > worst) worst = counts[k];
+                continue;
             }
+            for(j=0; j<k; ++j) if(hashes[j]==hashes[k]
+                && !memcmp(&keys[j], &keys[k], sizeof(*keys))) break;
+            if(j<k) continue;
+#endif
+            state_table_init(&tables[k], &state2);
+            counts[k++] = 0;
         }
-#else
-        do {
-            int _w = worst, j;
-            for(j=0; j<nthreads && (color-=nthreads)>=0; ++j) {
-                struct state state2 = *state;
-                state_update(&state2, candidate->symbols, color);
-                int count = state_compatible_count(&state2, least_c, tab, len);
-                if(count > _w) _w = count;
-            }
-            if(_w > worst) {
-                #pragma omp critical
-                {
-                    if(_w > worst) worst = _w;
-                }
+
+        for(from=len; from>0; from-=BATCH_TILE) {
+            int size = from<BATCH_TILE ? from : BATCH_TILE;
+            simd.compatible_batch(tables, k, counts, tab+from-size, size);
+            for(j=0; j<k; ++j) if(counts[j] > least_c) {
+#if STATE_CACHE
+                state_cache_store(&keys[j], hashes[j], least_c, counts[j]);
+#endif
+                return counts[j];
             }
-        } while(color>0 && worst<least_c);
+        }
+
+        for(j=0; j<k; ++j) {
+#if STATE_CACHE
+            state_cache_store(&keys[j], hashes[j], least_c, counts[j]);
 #endif
+            if(counts[j] > worst) worst = counts[j];
+        }
     }
 
     return worst;
 }
-
-#endif
-PRIVATE int find_worst(state *state, formula *candidate,
-    int all_colors, formula **tab, int len, int least_c) {
+#else
+PRIVATE int find_worst(state *state, formula candidate,
+    int all_colors, formula *tab, int len, int least_c) {
+    mask symbols[SIZE];
     int colors;
     int worst;
 
-#ifdef _OPENMP
-    if(nthreads>1) return find_worst_openmp(state, candidate,
-        all_colors, tab, len, least_c);
-#endif
-
+    formula_symbols(candidate, symbols);
     for(worst=0, colors=all_colors; --colors>=0;) {
         struct state state2 = *state;
         int count;
 
-        state_update(&state2, candidate->symbols, colors);
+        state_update(&state2, symbols, colors);
 
-        count = state_compatible_count(&state2, least_c, tab, len);
+        CACHED_COUNT(count, &state2, least_c,
+            samples_count(&state2, least_c, tab, len));
 
         if(count > worst) {
             worst = count;
@@ -1023,45 +3678,73 @@ PRIVATE int find_worst(state *state, formula *candidate,
 
     return worst;
 }
+#endif
+
+/* fills tab (of formulae.len cells) with the sample of the formulae
+   used by the block of 8 candidates, and returns its length */
+PRIVATE int sample_block(formula *tab, state *state, uint32_t seed,
+                         int rnd_thr, int block) {
+    uint32_t r = seed ^ (1u + block)*0x9E3779B9u;
+    int j, len = 0;
+    for(j=0; j<formulae.len; ++j) {
+        r ^= r<<13; r ^= r>>17; r ^= r<<5;
+        if(j!=(block<<3) && (int)(r & RAND_MAX)>rnd_thr) continue;
+#if SCORING==SCORE_HISTOGRAM
+        if(!state_compatible(state, formulae.tab[j])) continue;
+#endif
+        tab[len++] = formulae.tab[j];
+    }
+    return len;
+}
+
+#if STREAM_FINDALL
+/* index among the candidates of the last provisional guess, or -1 */
+PRIVATE int stream_hint_index(formula *tab, int len) {
+    int i, j;
+    if(!stream.hinted) return -1;
+    stream.hinted = false;      /* only for the round it was streamed for */
+    for(i=0; i<len; ++i) {
+        for(j=0; j<SIZE && SYMBOL(tab[i], j)==char_to_mask(stream.hint[j]); ++j);
+        if(j==SIZE) return i;
+    }
+    return -1;
+}
+#endif
 
 PRIVATE bool least_worst(state *state) {
     const long long use_sampling_threshold =
             MAX_FORMULAE_EXACT*(long long)MAX_FORMULAE_EXACT;
     const long long all_colors = ipow(3,SIZE);
-    int             least_c = formulae.len+1;
-    formula         *least_f = formulae.tab[0];
+    const uint32_t  seed = rand();
+    int             least_c = formulae.len+1, least_i = 0, done = 0;
+    formula         least_f;
     int             rnd_thr = -1, i;
 
-    ARRAY_DECL(formula *, candidates);
-    ARRAY_DECL(formula *, samples);
+    ARRAY_DECL(formula, candidates);
+    ARRAY_DECL(formula, samples);
 
     if(formulae.len == 0) return false;
 
     if(formulae.len == 1) {
         printf("Only one possible equation.\n");
-        for(i=0; i<SIZE; ++i) {
-            buffer[i] = mask_to_char(formulae.tab[0]->symbols[i]);
-        }
+        formula_to_buffer(formulae.tab[0], buffer);
         return true;
     }
 
     printf("Finding least worst equation..."); fflush(stdout);
     ARRAY_CPY(candidates, formulae);
     ARRAY_CPY(samples,    formulae);
+#if SCORING==SCORE_HISTOGRAM
+    /* secrets must agree with what is already known (relaxed rounds
+       keep the incompatible formulae as candidates) */
+    ARRAY_FILTER(samples, j, state_compatible(state, samples.tab[j]));
+#endif
 
     if(candidates.len >= MAX_FORMULAE_EXACT) {
         printf("simpl");
-        for(i=0; i<candidates.len;) {
-            if(candidates.tab[i]->used_count==SIZE)
-                ++i;
-            else ARRAY_REM(candidates, i);
-        }
+        ARRAY_FILTER(candidates, j, USED_COUNT(candidates.tab[j])==SIZE);
         if(candidates.len >= MAX_FORMULAE_EXACT) {
-            for(i=0; i<candidates.len;) {
-                if((candidates.tab[i]->unused & MSK0))
-                    ++i;
-                else ARRAY_REM(candidates, i);
-            }
+            ARRAY_FILTER(candidates, j, (UNUSED(candidates.tab[j]) & MSK0));
         }
         printf("..."); fflush(stdout);
     }
@@ -1073,47 +3756,103 @@ PRIVATE bool least_worst(state *state) {
         printf("%d.%01d%% sampl...", (int)(t/100), (int)(t%100)/10);
         fflush(stdout);
     }
+#if STATE_CACHE
+    state_cache_round(rnd_thr<0);
+#endif
+#if STREAM_FINDALL
+    /* the provisional guess bounds the candidates from the start. It is
+       scored on the very samples the loop uses for it, so that the
+       choice stays the same, only cut sooner. */
+    if((i = stream_hint_index(candidates.tab, candidates.len)) >= 0) {
+        ARRAY_DECL(formula, sampled);
+        formula *tab = samples.tab;
+        int      len = samples.len;
+        if(rnd_thr>=0) {
+            _ARRAY_PTR(&sampled, formulae.len);
+            len = sample_block(tab = sampled.tab, state, seed, rnd_thr, i>>3);
+        }
+#if BITSET_INDEX
+        bitset_index_build(&samples_index, tab, len);
+#endif
+        least_c = find_worst(state, candidates.tab[i], all_colors, tab, len, least_c);
+        least_i = i;
+#if BITSET_INDEX
+        bitset_index_done(&samples_index);
+#endif
+        ARRAY_DONE(sampled);
+    }
+#endif
     progress(-candidates.len);
 
-// #pragma omp parallel for
-    for(i=0; i<candidates.len; ++i) {
-        formula *candidate = candidates.tab[i];
-        int worst;
-
-        /* refesh our sample list from time to time */
-        if(rnd_thr>=0 && 0==(i & 7)) {
-            int j;
-            while(samples.len>0) ARRAY_REM(samples, 0);
-            for(j=0; j<formulae.len; ++j) if(j==i || rand()<=rnd_thr) {
-                ARRAY_ADD(samples, formulae.tab[j]);
-            }
-        }
+    /* candidates are shared dynamically between the threads, which all
+       cut their evaluation as soon as it exceeds the best score so far.
+       Ties go to the first candidate, and sampled lists only depend on
+       the block of 8 candidates they are used for, so that the choice
+       does not depend on the number of threads. */
+    PRAGMA_OMP(parallel)
+    {
+        ARRAY_DECL(formula, sampled);
+        formula *tab = samples.tab;
+        int      len = samples.len, block = -1;
 
-        worst = find_worst(state, candidate,
-            all_colors, samples.tab, samples.len, least_c);
-        progress(i);
+#if BITSET_INDEX
+        if(rnd_thr<0) bitset_index_build(&samples_index, tab, len);
+#endif
+        PRAGMA_OMP(for schedule(dynamic, 8) nowait)
+        for(i=0; i<candidates.len; ++i) {
+            formula candidate = candidates.tab[i];
+            int worst, bound;
+
+            /* refesh our sample list from time to time */
+            if(rnd_thr>=0 && block!=(i>>3)) {
+                _ARRAY_PTR(&sampled, formulae.len);
+                sampled.len = sample_block(sampled.tab, state, seed,
+                                           rnd_thr, block = i>>3);
+                tab = sampled.tab;
+                len = sampled.len;
+#if BITSET_INDEX
+                bitset_index_build(&samples_index, tab, len);
+#endif
+            }
 
-        /* keep the least-worse candidate */
-        if(worst<least_c) {
-            least_c = worst;
-            least_f = candidate;
+            PRAGMA_OMP(atomic read)
+            bound = least_c;
+            worst = find_worst(state, candidate, all_colors, tab, len, bound);
+
+            /* keep the least-worse candidate */
+            if(worst<=bound) {
+                PRAGMA_OMP(critical)
+                if(worst<least_c || (worst==least_c && i<least_i)) {
+                    PRAGMA_OMP(atomic write)
+                    least_c = worst;
+                    least_i = i;
 #ifdef DEBUG
-            int  j;
-            printf("\n%5d [", worst); fflush(stdout);
-            for(j=0; j<SIZE; ++j) putchar(mask_to_char(least_f->symbols[j]));
-            putchar(']');
-            fflush(stdout);
+                    int  j;
+                    printf("\n%5d [", worst); fflush(stdout);
+                    for(j=0; j<SIZE; ++j) putchar(mask_to_char(SYMBOL(candidate, j)));
+                    putchar(']');
+                    fflush(stdout);
 #endif
+                }
+            }
+            PRAGMA_OMP(critical(progress))
+            progress(++done);
         }
+        ARRAY_DONE(sampled);
+#if BITSET_INDEX
+        bitset_index_done(&samples_index);
+#endif
     }
+    least_f = candidates.tab[least_i];
     ARRAY_DONE(samples);
     ARRAY_DONE(candidates);
     printf("done");
+#if STATE_CACHE
+    if(state_cache_hits()>=0) printf(" (%.0f%% cached)", state_cache_hits());
+#endif
     if((i=progress(0))>1) printf(" (%s%d%s secs)", A_BOLD, i, A_NORM);
     printf("\n");
-    for(i=0; i<SIZE; ++i) {
-        buffer[i] = mask_to_char(least_f->symbols[i]);
-    }
+    formula_to_buffer(least_f, buffer);
 #ifdef DEBUG
     printf("least=");
     for(i=0; i<SIZE; ++i) putchar(buffer[i]);
@@ -1124,34 +3863,22 @@ PRIVATE bool least_worst(state *state) {
 
 /*****************************************************************************/
 
-PRIVATE jmp_buf _env;
-PRIVATE void _return(void) {
-    longjmp(_env, 1);
-}
-#define _Backtracking(S) do {                       \
-    void (*_Fiasco)(void) = Fiasco;                 \
-    Fiasco = _return;                               \
-    if(!setjmp(_env)) do Backtracking(S) while(0);  \
-    else Fiasco = _Fiasco;                          \
-} while(0)
-
-/*****************************************************************************/
-
 PRIVATE void remove_impossible(state *s) {
 #ifdef DEBUG
     size_t before = formulae.len;
 #endif
-    int i;
-    for(i = 0; i<formulae.len;) {
-        if(state_compatible(s, formulae.tab[i]))
-            ++i;
-        else ARRAY_REM(formulae, i);
-    }
+    ARRAY_FILTER(formulae, i, state_compatible(s, formulae.tab[i]));
 #ifdef DEBUG
     printf("Removed: %d\n", before - formulae.len);
 #endif
 }
 
+/* target whose equations are only enumerated once the answer to the
+   opening guess is known, under its constraints */
+PRIVATE rat *pending;
+
+PRIVATE void find_equations(rat *target, const state *st);
+
 PRIVATE bool play_round(state *state, bool relaxed) {
     int colors;
     while(true) {
@@ -1160,7 +3887,7 @@ PRIVATE bool play_round(state *state, bool relaxed) {
         struct state back = *state;
         int c;
 
-        printf(formulae.len>1 ? "Try: %s" : "Sol: %s", A_BOLD);
+        printf(formulae.len>1 || pending ? "Try: %s" : "Sol: %s", A_BOLD);
         for(i=0; i<SIZE; ++i) {
             symbs[i] = char_to_mask(buffer[i]);
             putchar(buffer[i]);
@@ -1168,7 +3895,7 @@ PRIVATE bool play_round(state *state, bool relaxed) {
         printf("%s\n", A_NORM);
 
 #if !defined(NUMBLE) || !defined(DEBUG)
-        if(formulae.len<=1) {
+        if(formulae.len<=1 && pending==NULL) {
             --formulae.len;
             fflush(stdout);
             return false;
@@ -1211,6 +3938,7 @@ PRIVATE bool play_round(state *state, bool relaxed) {
 #ifdef DEBUG
         state_print(state);
 #endif
+        if(pending != NULL) find_equations(pending, state);
         if(0 == state_compatible_count(
                 state,        INT_MAX,
                 formulae.tab, formulae.len)) {
@@ -1227,19 +3955,24 @@ PRIVATE bool play_round(state *state, bool relaxed) {
             *state = back;
         } else {
             bool ok;
+            pending = NULL;
             if(relaxed) {
                 state_relax(state);
                 for(i = 0; i<formulae.len; ++i) {
-                    formula *f = formulae.tab[i];
+                    formula f = formulae.tab[i];
                     int j;
-                    for(j=0; j<SIZE && f->symbols[j]==symbs[j]; ++j);
+                    for(j=0; j<SIZE && SYMBOL(f, j)==symbs[j]; ++j);
                     if(j == SIZE) {
-                        ARRAY_REM(formulae, i);
+                        memmove(formulae.tab + i, formulae.tab + i + 1,
+                            (--formulae.len - i)*sizeof(*formulae.tab));
                         break;
                     }
                 }
             } else {
                 remove_impossible(state);
+#if FEEDBACK_MATRIX
+                matrix_build(formulae.tab, formulae.len);
+#endif
             }
             ok = least_worst(state);
             if(relaxed) {
@@ -1257,18 +3990,17 @@ PRIVATE bool play_round(state *state, bool relaxed) {
 
 #if DO_SORT
 PRIVATE int cmp_formula(const void *_a, const void *_b) {
-    formula * const *x = _a, * const *y = _b;
-    const formula *a = *x, *b = *y;
+    const formula a = *(const formula *)_a, b = *(const formula *)_b;
     int d=0;
 #if ALLOW_PARENTHESIS
 #if (CONFIG&8)
-    d = (b->unused & MSKbra) - (a->unused & MSKbra);
+    d = (UNUSED(b) & MSKbra) - (UNUSED(a) & MSKbra);
 #endif
 #endif
 #if (CONFIG&1)
-    if(d==0) d = b->used_count - a->used_count;
+    if(d==0) d = USED_COUNT(b) - USED_COUNT(a);
 #else
-    if(d==0) d = a->used_count - b->used_count;
+    if(d==0) d = USED_COUNT(a) - USED_COUNT(b);
 #endif
 #if (CONFIG&2)
     int i = SIZE; while(d==0 && --i>=0) d =
@@ -1276,9 +4008,9 @@ PRIVATE int cmp_formula(const void *_a, const void *_b) {
     int i; for(i=0;d==0 && i<SIZE;++i) d =
 #endif
 #if (CONFIG&4)
-        b->symbols[i] - a->symbols[i];
+        SYMBOL(b, i) - SYMBOL(a, i);
 #else
-        a->symbols[i] - b->symbols[i];
+        SYMBOL(a, i) - SYMBOL(b, i);
 #endif
     // if(d==0) d = a->used - b->used;
     // int i; for(i=0; d==0 && i<SIZE; ++i) d = (*b)->symbols[i] - (*a)->symbols[i];
@@ -1304,7 +4036,7 @@ PRIVATE void shuffle_formulae(void) {
 
     while(i>1) {
         int j = rand() % i--;
-        formula *t = formulae.tab[i];
+        formula t = formulae.tab[i];
         formulae.tab[i] = formulae.tab[j];
         formulae.tab[j] = t;
     }
@@ -1319,6 +4051,138 @@ PRIVATE void shuffle_formulae(void) {
 
 /*****************************************************************************/
 
+#if STREAM_FINDALL
+/* the best of a few guesses (and of the previous one) against a sample
+   of the equations found so far, for the player to start with while the
+   enumeration goes on */
+PRIVATE formula stream_guess(formula best) {
+    static int hist[ALL_COLORS];
+    size_t n = formulae.len, i, j;
+    size_t secrets = n < STREAM_SECRETS ? n : STREAM_SECRETS;
+    int best_worst = INT_MAX;
+
+    /* the previous guess competes again, on the larger sample */
+    for(i=0; i<=STREAM_CANDIDATES; ++i) {
+        formula guess = i<STREAM_CANDIDATES ? formulae.tab[i*n/STREAM_CANDIDATES] : best;
+        int worst = 0;
+        memset(hist, 0, sizeof(hist));
+        for(j=0; j<secrets; ++j) {
+            int c = ++hist[feedback(guess, formulae.tab[j*n/secrets])];
+            if(c > worst) worst = c;
+        }
+        if(worst < best_worst) {best_worst = worst; best = guess;}
+    }
+    return best;
+}
+
+/* adds the streamed equations to the formulae, proposing a guess each
+   time their number doubles */
+PRIVATE void *stream_consume(void *unused) {
+    size_t next = STREAM_FIRST;
+    formula best = 0;
+
+    for(;;) {
+        stream_chunk *c;
+        size_t k;
+
+        pthread_mutex_lock(&stream.lock);
+        while((c = stream.head->next) == NULL && !stream.done)
+            pthread_cond_wait(&stream.ready, &stream.lock);
+        pthread_mutex_unlock(&stream.lock);
+        if(c == NULL) break;
+
+        free(stream.head);
+        stream.head = c;
+        for(k=0; k<c->len; ++k)
+            ARRAY_ADD(formulae, arena_add(c->tab + k*SIZE));
+        progress(INT_MAX);
+        if(formulae.len >= next) {
+            char buf[SIZE+1];
+            if(next == STREAM_FIRST) best = formulae.tab[0];
+            formula_to_buffer(best = stream_guess(best), buf);
+            memcpy(stream.hint, buf, SIZE);
+            stream.hinted = true;
+            buf[SIZE] = '\0';
+            printf("\nProvisional guess: %s%s%s (%'u so far)...",
+                A_BOLD, buf, A_NORM, (unsigned)formulae.len);
+            fflush(stdout);
+            next *= 2;
+        }
+    }
+    return unused;
+}
+
+/* enumerates the equations worth target (with all the threads) while
+   another thread adds them to the formulae and proposes a guess now and
+   then */
+PRIVATE void stream_findall(rat *target) {
+    pthread_t consumer;
+
+    stream_init();
+    if(pthread_create(&consumer, NULL, stream_consume, NULL) != 0) {
+        free(stream.head);
+        stream.on = false;
+        if(ENUMERATOR==ENUM_SKELETON) skel_findall(target); else findall(target);
+        return;
+    }
+    if(ENUMERATOR==ENUM_SKELETON) skel_findall(target); else findall(target);
+    stream_close();
+    pthread_join(consumer, NULL);
+    free(stream.head);
+    stream.on = false;
+}
+#endif
+
+/* fills the formulae with the equations worth target, only those
+   compatible with st if not NULL */
+PRIVATE void find_equations(rat *target, const state *st) {
+    int secs;
+
+#ifdef NUMBLE
+    (void)target;
+    printf("Finding equations...");
+#else
+    if(rat_whole(target))
+            printf("Finding equations for %s%d%s...",
+                A_BOLD, target->p, A_NORM);
+    else    printf("Finding equations for %s%d/%d%s...",
+                A_BOLD, target->p, target->q, A_NORM);
+#endif
+    fflush(stdout);
+
+    formulae.len = 0;
+    progress(-1);
+#if FORMULA_DB
+    if(st!=NULL || !db_load(target))
+#endif
+    {
+        arena_done();
+        constrain(st);
+        if(st==NULL && index_file!=NULL && index_read(index_file, target));
+#if STREAM_FINDALL
+        /* dp_findall() takes a fraction of a second: only the other
+           enumerators are slow enough to gain from streaming */
+        else if(ENUMERATOR!=ENUM_DP && nthreads>1) stream_findall(target);
+#endif
+        else if(ENUMERATOR==ENUM_DP) dp_findall(target);
+        else if(ENUMERATOR==ENUM_SKELETON) skel_findall(target);
+        else findall(target);
+        constrain(NULL);
+#if DO_SORT
+        /* lay the arena out in sorted order so that the index
+           arrays are scanned sequentially */
+        sort_formulae();
+        arena_reorder(formulae.tab, formulae.len);
+#endif
+#if FORMULA_DB
+        if(st==NULL) db_save(target);
+#endif
+    }
+    secs = progress(0);
+    printf("done ("); if(secs>1) printf("%s%d%s secs, ", A_BOLD, secs, A_NORM);
+    printf("%s%'u%s found)\n", A_BOLD, (unsigned)formulae.len, A_NORM);
+}
+
 PRIVATE void title(void) {
     char *TITLE1 = "Helper for ";
     char *TITLE2 = " by Samuel Devulder";
@@ -1330,12 +4194,21 @@ PRIVATE void title(void) {
     for(i=len; --i>=0; putchar('~')){} putchar('\n');
 }
 
+/* whether arg is a number (e.g. a negative target) and not an option */
+PRIVATE bool is_number(const char *arg) {
+    char *end;
+    (void)strtod(arg, &end);
+    return end!=arg && *end=='\0';
+}
+
 /*****************************************************************************/
 
 int main(int argc, char **argv) {
-    ARRAY_DECL(formula *, found);
+    ARRAY_DECL(formula, found);
     state state;
     rat target;
+    const char *opening = NULL, *index_out = NULL;
+    bool count_only = false;
     int i = 0;
 
     srand(time(0));
@@ -1346,13 +4219,58 @@ int main(int argc, char **argv) {
         A_NORM = "\033[0m";
     }
 
+    /* options stop at the target, which may be negative */
+    while(optind<argc && !is_number(argv[optind]) &&
+          (i = getopt(argc, argv, "+cg:i:w:m:M:")) != -1) switch(i) {
+        case 'c': count_only = true; break;
+        case 'i': index_file = optarg; break;
+        case 'm': index_min = atof(optarg); break;
+        case 'M': index_max = atof(optarg); break;
+        case 'w': index_out = optarg; break;
+        case 'g':
+        opening = optarg;
+        for(i=0; opening[i] && char_to_mask(opening[i])!=MSKnone; ++i);
+        if(i==SIZE && opening[i]=='\0') break;
+        /* fall through */
+        default:
+        fprintf(stderr, "Usage: %s [-i index] [-g guess] [target]\n"
+                        "       %s [-m min] [-M max] -w index\n"
+                        "       %s [-m min] [-M max] -c [target]\n"
+                        "options come before the target, e.g. %s -c -3\n",
+                        argv[0], argv[0], argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    i = 0;
+
+    if(index_out != NULL) {
+        index_write(index_out);
+        return 0;
+    }
+
+    if(count_only) {
+        uint64_t tally[SIZE+1];
+        if(optind>=argc) {
+            count_table();
+            return 0;
+        }
+#ifdef NUMBLE
+        rat_integer(&target, 0);
+#else
+        rat_double(&target, atof(argv[optind]));
+#endif
+        count_header();
+        count_equations(&target, tally);
+        count_print(target.p, target.q, tally);
+        return 0;
+    }
+
     title();
 
-    if(argc>1) {
+    if(optind<argc) {
 #ifdef NUMBLE
         rat_integer(&target, 0);
 #else
-        rat_double(&target, atof(argv[1]));
+        rat_double(&target, atof(argv[optind]));
 #endif
     } else {
         int ignored;
@@ -1383,26 +4301,17 @@ int main(int argc, char **argv) {
     }
     if(nthreads>1) printf("Using %s%d%s threads.\n", A_BOLD, nthreads, A_NORM);
 #endif
+    simd_init();
 
 #ifdef NUMBLE
     do {
-		if(found.len==0) {
-			printf("Finding equations..."); fflush(stdout);
-		}
-#else
-        if(rat_whole(&target))
-                printf("Finding equations for %s%d%s...",
-                    A_BOLD, target.p, A_NORM);
-        else    printf("Finding equations for %s%d/%d%s...",
-                    A_BOLD, target.p, target.q, A_NORM);
-        fflush(stdout);
 #endif
-
-		if(found.len==0) {
-			formulae.len = 0;
-			progress(-1); _Backtracking(findall(&target)); i = progress(0);
-			printf("done ("); if(i>1) printf("%s%d%s secs, ", A_BOLD, i, A_NORM);
-			printf("%s%'u%s found)\n", A_BOLD, (unsigned)formulae.len, A_NORM);
+		if(opening != NULL) {
+			/* no universe: the equations compatible with the answer
+			   to the opening are enumerated by play_round() */
+			pending = &target;
+		} else if(found.len==0) {
+			find_equations(&target, NULL);
 			ARRAY_CPY(found, formulae);
 		} else {
 			ARRAY_CPY(formulae, found);
@@ -1413,14 +4322,19 @@ int main(int argc, char **argv) {
 #endif
 #if DO_SORT
         sort_formulae();
+#endif
+#if FEEDBACK_MATRIX
+        matrix_done();
+        if(MATRIX_EAGER && pending == NULL) matrix_build(formulae.tab, formulae.len);
 #endif
         state_init(&state);
+        if(opening != NULL) memcpy(buffer, opening, SIZE); else
 #if NUMBLE
         memcpy(buffer, "9*42=378", SIZE);
 #else
         least_worst(&state);
 #endif
-        for(i=1; play_round(&state, i==1); ++i);
+        for(i=1; play_round(&state, i==1 && opening==NULL); ++i);
         printf("Solved in %s%d%s round%s.\n", A_BOLD, i, A_NORM, i>1?"s":"");
         if(formulae.len>0)
             printf("You were lucky. There existed %s%u%s other possibilit%s.\n", 
@@ -1433,8 +4347,14 @@ int main(int argc, char **argv) {
         title();
     } while(true);
 #endif
-    while(found.len) {free(found.tab[0]); ARRAY_REM(found, 0);}
     ARRAY_DONE(found);
     ARRAY_DONE(formulae);
+    arena_done();
+#if FEEDBACK_MATRIX
+    matrix_done();
+#endif
+#if STATE_CACHE
+    state_cache_done();
+#endif
     return 0;
 }